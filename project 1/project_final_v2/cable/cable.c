@@ -26,17 +26,45 @@
 // included by <termios.h>
 #define BAUDRATE B9600         // For struct termios
 #define DEFAULT_BAUDRATE 9600  // For the delaying transmissions
+#define MIN_BAUDRATE 50
+#define MAX_BAUDRATE 12000000
 #define _POSIX_SOURCE 1        // POSIX compliant source
 #define FALSE 0
 #define TRUE 1
 
 #define BUF_SIZE 2048
 
+// Shortest wait between iterations of the main loop, in nanoseconds.
+// Rates whose byte delay is shorter move several bytes per iteration.
+#define TICK_NSEC 50000
+
+// Flow control the serial ports use. When the receiving side cannot take
+// more bytes, the cable keeps them and stops the sending side: it no longer
+// reads from it (CTS off), or sends it XOFF. The sender is let go again
+// once everything kept was delivered.
+#define FLOW_NONE 0
+#define FLOW_RTSCTS 1
+#define FLOW_XONXOFF 2
+#define FLOW_STOP_LEVEL 64  // Bytes kept before the sender is stopped
+#define XON 0x11
+#define XOFF 0x13
+
+// Bytes a port could not take yet, kept while flow control holds back the
+// other side
+struct Backlog {
+    char *data;
+    int length;
+    int capacity;
+    int stopped;  // TRUE while the sending side is told to stop
+};
+
 // Current running parameters
 struct Parameters {
     int cableOn;
     double byteER;   // Byte error rate
-    struct timespec byteDelay;
+    long byteDelay;            // Byte delay in nsec
+    int bytesPerTick;          // Byte slots handled per iteration
+    struct timespec tickDelay; // Time taken by bytesPerTick bytes
     unsigned long propDelay;   // Desired propagation delay in usec
     int bufSize;  // Dimensioned to enforce the propagation delay
     char *tx2rx;
@@ -45,6 +73,9 @@ struct Parameters {
     char *rx2tx;
     char *rx2txValid;  // TRUE if corresponding entry holds a byte
     long rx2txIdx;     // Input index for the tx2rx buffer
+    int flowControl;
+    struct Backlog tx2rxBacklog;
+    struct Backlog rx2txBacklog;
     FILE *logfile;
 };
 
@@ -56,6 +87,7 @@ struct Parameters par = {
     .tx2rxValid = NULL,
     .rx2tx = NULL,
     .rx2txValid = NULL,
+    .flowControl = FLOW_NONE,
     .logfile = NULL};
 
 // Returns: serial port file descriptor (fd).
@@ -98,13 +130,13 @@ void addNoiseToBuffer(unsigned char *buf, size_t errorIndex)
 int init_ring_buffers(void)
 {
     long nsecPropDelay = 1000 * par.propDelay;
-    long bytesInFlight = nsecPropDelay / par.byteDelay.tv_nsec;
+    long bytesInFlight = nsecPropDelay / par.byteDelay;
     // Round instead of truncating
-    if (nsecPropDelay % par.byteDelay.tv_nsec > par.byteDelay.tv_nsec / 2)
+    if (nsecPropDelay % par.byteDelay > par.byteDelay / 2)
     {
         ++bytesInFlight;
     }
-    long actualPropDelay = bytesInFlight * par.byteDelay.tv_nsec / 1000; // usec
+    long actualPropDelay = bytesInFlight * par.byteDelay / 1000; // usec
     par.bufSize = bytesInFlight + 1;
     par.tx2rx = realloc(par.tx2rx, par.bufSize);
     par.tx2rxValid = realloc(par.tx2rxValid, par.bufSize);
@@ -128,13 +160,92 @@ void set_baud_rate(unsigned long baud)
 {
     // 10 bit times per byte; delay in nanoseconds
     double delay = 1.0e10 / baud;
-    par.byteDelay.tv_sec = 0;
-    par.byteDelay.tv_nsec = (long) delay;
+    par.byteDelay = (long) delay;
+
+    // Sleeping once per byte cannot keep up with fast rates, so those are
+    // paced per batch of bytes instead
+    par.bytesPerTick = delay >= TICK_NSEC ? 1 : (int) (TICK_NSEC / delay);
+    long tickDelay = (long) (delay * par.bytesPerTick + 0.5);
+    par.tickDelay.tv_sec = tickDelay / 1000000000;
+    par.tickDelay.tv_nsec = tickDelay % 1000000000;
     printf("BAUD RATE: %lu\n", baud);
     init_ring_buffers();
 }
 
 
+// Write bytes that left the cable to fdOut. Without flow control whatever
+// the port cannot take is lost; with it, the bytes are kept and fdSender,
+// the port they came from, is stopped until they have all been delivered.
+void deliver(int fdOut, int fdSender, struct Backlog *backlog, const char *bytes, int count)
+{
+    if (par.flowControl == FLOW_NONE)
+    {
+        if (count > 0)
+        {
+            write(fdOut, bytes, count);
+        }
+        return;
+    }
+
+    if (backlog->length + count > backlog->capacity)
+    {
+        int capacity = 2 * (backlog->length + count);
+        char *grown = realloc(backlog->data, capacity);
+        if (grown == NULL)
+        {
+            return;
+        }
+        backlog->data = grown;
+        backlog->capacity = capacity;
+    }
+    memcpy(backlog->data + backlog->length, bytes, count);
+    backlog->length += count;
+
+    if (backlog->length > 0)
+    {
+        int written = write(fdOut, backlog->data, backlog->length);
+        if (written > 0)
+        {
+            backlog->length -= written;
+            memmove(backlog->data, backlog->data + written, backlog->length);
+        }
+    }
+
+    char control;
+    if (!backlog->stopped && backlog->length > FLOW_STOP_LEVEL)
+    {
+        backlog->stopped = TRUE;
+        control = XOFF;
+    }
+    else if (backlog->stopped && backlog->length == 0)
+    {
+        backlog->stopped = FALSE;
+        control = XON;
+    }
+    else
+    {
+        return;
+    }
+    if (par.flowControl == FLOW_XONXOFF)
+    {
+        write(fdSender, &control, 1);
+    }
+}
+
+
+// Drop the kept bytes and let both senders go, when flow control changes
+void reset_backlog(int fdSender, struct Backlog *backlog)
+{
+    if (backlog->stopped && par.flowControl == FLOW_XONXOFF)
+    {
+        char control = XON;
+        write(fdSender, &control, 1);
+    }
+    backlog->length = 0;
+    backlog->stopped = FALSE;
+}
+
+
 // Make the program use RT priority to improve precision in timing
 void set_rt_priority(void) {
 #ifdef __linux__
@@ -243,8 +354,11 @@ void help()
            "--- on           : connect the cable and data is exchanged (default state)\n"
            "--- off          : disconnect the cable disabling data to be exchanged\n"
            "--- ber <ber>    : add noise to data bits at a specified BER (default=0)\n"
-           "--- baud <rate>  : set baud rate, between 1200 and 115200 (default=9600)\n"
+           "--- baud <rate>  : set baud rate, between 50 and 12000000 (default=9600)\n"
            "                   note that 10 bits are sent per byte (8-N-1)\n"
+           "--- flow <mode>  : flow control used by the ports: none, rtscts or xonxoff\n"
+           "                   (default=none); the cable holds back a sender whose\n"
+           "                   receiver cannot keep up instead of losing bytes\n"
            "--- prop <delay> : set the propagation delay in usec (0-1000000, default=0)\n"
            "                   will be approximated to an integer multiple of the byte\n"
            "                   delay (10 / baud_rate)\n"
@@ -313,6 +427,7 @@ int main(int argc, char *argv[])
 
     // To compensate for deviations in byte transmission time
     struct timespec currentTime, nextTxTime, timeDiff, nextWait;
+    char txBytes[BUF_SIZE], rxBytes[BUF_SIZE], txOut[BUF_SIZE], rxOut[BUF_SIZE];
     int skipWait = FALSE;
     int unreliableRate = FALSE;
     clock_gettime(CLOCK_MONOTONIC, &nextTxTime);
@@ -322,7 +437,7 @@ int main(int argc, char *argv[])
         // Check how much waiting time we should have (if any)
         clock_gettime(CLOCK_MONOTONIC, &currentTime);
         timeDiff = timespec_diff(&currentTime, &nextTxTime);
-        nextTxTime = timespec_sum(&nextTxTime, &par.byteDelay);
+        nextTxTime = timespec_sum(&nextTxTime, &par.tickDelay);
         if (timeDiff.tv_sec >= 1)
         {
             if (unreliableRate == FALSE)
@@ -342,104 +457,123 @@ int main(int argc, char *argv[])
             skipWait = FALSE;
         }
 
-        // Read from Tx
-        int bytesFromTx = read(fdTx, par.tx2rx + par.tx2rxIdx, 1);
-        par.tx2rxValid[par.tx2rxIdx] = bytesFromTx > 0;
-
-        // Read from Rx
-        int bytesFromRx = read(fdRx, par.rx2tx + par.rx2txIdx, 1);
-        par.rx2txValid[par.rx2txIdx] = bytesFromRx > 0;
+        // Read what arrived during this tick from each side, unless RTS/CTS
+        // holds that side back
+        int rtsCts = par.flowControl == FLOW_RTSCTS;
+        int bytesFromTx = rtsCts && par.tx2rxBacklog.stopped ? 0 : read(fdTx, txBytes, par.bytesPerTick);
+        int bytesFromRx = rtsCts && par.rx2txBacklog.stopped ? 0 : read(fdRx, rxBytes, par.bytesPerTick);
+        int txOutLen = 0;
+        int rxOutLen = 0;
 
-        if (!par.cableOn)
+        for (int slot = 0; slot < par.bytesPerTick; ++slot)
         {
-            // Ignore what was read
-            par.tx2rxValid[par.tx2rxIdx] = 0;
-            par.rx2txValid[par.rx2txIdx] = 0;
-        }
-
-        if (par.logfile != NULL)  // Currently logging
-        {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            // Byte slot: store what was read, if anything
+            par.tx2rxValid[par.tx2rxIdx] = slot < bytesFromTx;
+            if (slot < bytesFromTx)
             {
-                sprintf(tx2rxTx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
+                par.tx2rx[par.tx2rxIdx] = txBytes[slot];
             }
-            else
+            par.rx2txValid[par.rx2txIdx] = slot < bytesFromRx;
+            if (slot < bytesFromRx)
             {
-                memcpy(tx2rxTx, "  ", 3);
+                par.rx2tx[par.rx2txIdx] = rxBytes[slot];
             }
-            if (par.rx2txValid[par.rx2txIdx])
+
+            if (!par.cableOn)
             {
-                sprintf(rx2txTx, "%02hhX", par.rx2tx[par.rx2txIdx]);
+                // Ignore what was read
+                par.tx2rxValid[par.tx2rxIdx] = 0;
+                par.rx2txValid[par.rx2txIdx] = 0;
             }
-            else
+
+            if (par.logfile != NULL)  // Currently logging
             {
-                memcpy(rx2txTx, "  ", 3);
+                if (par.tx2rxValid[par.tx2rxIdx])
+                {
+                    sprintf(tx2rxTx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
+                }
+                else
+                {
+                    memcpy(tx2rxTx, "  ", 3);
+                }
+                if (par.rx2txValid[par.rx2txIdx])
+                {
+                    sprintf(rx2txTx, "%02hhX", par.rx2tx[par.rx2txIdx]);
+                }
+                else
+                {
+                    memcpy(rx2txTx, "  ", 3);
+                }
             }
-        }
 
-        // Advance indices to next position
-        par.tx2rxIdx = (par.tx2rxIdx + 1) % par.bufSize;
-        par.rx2txIdx = (par.rx2txIdx + 1) % par.bufSize;
+            // Advance indices to next position
+            par.tx2rxIdx = (par.tx2rxIdx + 1) % par.bufSize;
+            par.rx2txIdx = (par.rx2txIdx + 1) % par.bufSize;
 
-        if (par.cableOn)
-        {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            if (par.cableOn)
             {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
+                if (par.tx2rxValid[par.tx2rxIdx])
                 {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.tx2rx[par.tx2rxIdx] ^= (char) 1 << rand() % 8;
+                    // Add error, if applicable
+                    if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
+                    {
+                        // At most one wrong bit per byte, good enough if ber < 0.02
+                        par.tx2rx[par.tx2rxIdx] ^= (char) 1 << rand() % 8;
+                    }
+                    rxOut[rxOutLen++] = par.tx2rx[par.tx2rxIdx];
                 }
-                write(fdRx, par.tx2rx + par.tx2rxIdx, 1);
-            }
 
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
+                if (par.rx2txValid[par.rx2txIdx])
                 {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.rx2tx[par.rx2txIdx] ^= (char) 1 << rand() % 8;
+                    // Add error, if applicable
+                    if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
+                    {
+                        // At most one wrong bit per byte, good enough if ber < 0.02
+                        par.rx2tx[par.rx2txIdx] ^= (char) 1 << rand() % 8;
+                    }
+                    txOut[txOutLen++] = par.rx2tx[par.rx2txIdx];
                 }
-                write(fdTx, par.rx2tx + par.rx2txIdx, 1);
             }
-        }
 
-        if (par.logfile != NULL)  // Currently logging
-        {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            if (par.logfile != NULL)  // Currently logging
             {
-                sprintf(tx2rxRx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
-            }
-            else
-            {
-                memcpy(tx2rxRx, "  ", 3);
-            }
-            if (par.rx2txValid[par.rx2txIdx])
-            {
-                sprintf(rx2txRx, "%02hhX", par.rx2tx[par.rx2txIdx]);
-            }
-            else
-            {
-                memcpy(rx2txRx, "  ", 3);
-            }
+                if (par.tx2rxValid[par.tx2rxIdx])
+                {
+                    sprintf(tx2rxRx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
+                }
+                else
+                {
+                    memcpy(tx2rxRx, "  ", 3);
+                }
+                if (par.rx2txValid[par.rx2txIdx])
+                {
+                    sprintf(rx2txRx, "%02hhX", par.rx2tx[par.rx2txIdx]);
+                }
+                else
+                {
+                    memcpy(rx2txRx, "  ", 3);
+                }
 
-            if (*tx2rxTx == ' ' && *rx2txTx == ' ' && *tx2rxRx == ' ' && *rx2txRx == ' ')
-            {
-                if (cableIdle == FALSE)
+                if (*tx2rxTx == ' ' && *rx2txTx == ' ' && *tx2rxRx == ' ' && *rx2txRx == ' ')
+                {
+                    if (cableIdle == FALSE)
+                    {
+                        fputs("---------------\n", par.logfile);
+                        cableIdle = TRUE;
+                    }
+                }
+                else
                 {
-                    fputs("---------------\n", par.logfile);
-                    cableIdle = TRUE;
+                    fprintf(par.logfile, "%s  %s | %s  %s\n", tx2rxTx, tx2rxRx, rx2txTx, rx2txRx);
+                    cableIdle = FALSE;
                 }
             }
-            else
-            {
-                fprintf(par.logfile, "%s  %s | %s  %s\n", tx2rxTx, tx2rxRx, rx2txTx, rx2txRx);
-                cableIdle = FALSE;
-            }
         }
 
+        // Deliver the bytes that left the ring buffers
+        deliver(fdRx, fdTx, &par.tx2rxBacklog, rxOut, rxOutLen);
+        deliver(fdTx, fdRx, &par.rx2txBacklog, txOut, txOutLen);
+
         // Read commands from STDIN to control the cable mode
         int fromStdin = read(STDIN_FILENO, rxStdin, BUF_SIZE);
         if (fromStdin > 0)
@@ -488,20 +622,35 @@ int main(int argc, char *argv[])
             {
                 unsigned long baud = 0;
                 sscanf(rxStdin + 5, "%lu", &baud);
-                switch (baud) {
-                    case 1200:
-                    case 1800:
-                    case 2400:
-                    case 4800:
-                    case 9600:
-                    case 19200:
-                    case 38400:
-                    case 57600:
-                    case 115200:
-                        set_baud_rate(baud);
-                        break;
-                    default:
-                        printf("UNSUPPORTED BAUD RATE: must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600 or 115200\n");
+                if (baud >= MIN_BAUDRATE && baud <= MAX_BAUDRATE)
+                {
+                    set_baud_rate(baud);
+                }
+                else
+                {
+                    printf("UNSUPPORTED BAUD RATE: must be between %d and %d\n", MIN_BAUDRATE, MAX_BAUDRATE);
+                }
+            }
+            else if (strncmp(rxStdin, "flow ", 5) == 0)
+            {
+                int flowControl = -1;
+                if (strcmp(rxStdin + 5, "none") == 0)
+                    flowControl = FLOW_NONE;
+                else if (strcmp(rxStdin + 5, "rtscts") == 0)
+                    flowControl = FLOW_RTSCTS;
+                else if (strcmp(rxStdin + 5, "xonxoff") == 0)
+                    flowControl = FLOW_XONXOFF;
+
+                if (flowControl < 0)
+                {
+                    printf("UNSUPPORTED FLOW CONTROL: must be none, rtscts or xonxoff\n");
+                }
+                else
+                {
+                    reset_backlog(fdTx, &par.tx2rxBacklog);
+                    reset_backlog(fdRx, &par.rx2txBacklog);
+                    par.flowControl = flowControl;
+                    printf("FLOW CONTROL SET TO %s\n", rxStdin + 5);
                 }
             }
             else if (strncmp(rxStdin, "prop ", 5) == 0)
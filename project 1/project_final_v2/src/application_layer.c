@@ -1,20 +1,115 @@
+#define _GNU_SOURCE // fallocate()
+
 #include "application_layer.h"
+#include "compression.h"
 #include "link_layer.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 // Control packet types
 #define PKT_TYPE_DATA 1
 #define PKT_TYPE_START 2
 #define PKT_TYPE_END 3
+#define PKT_TYPE_BONDED_DATA 4 // Data packet numbered across all bonded links
+#define PKT_TYPE_COMPRESSED_DATA 5 // Data packet holding a compressed chunk
+#define PKT_TYPE_PLACED_DATA 6 // Data packet carrying its file offset
+
+// Data packet headers: type, sequence number and length; placed data packets
+// give a 64-bit file offset (big-endian) instead of the sequence number
+#define DATA_HEADER_SIZE 4
+#define PLACED_HEADER_SIZE 11
 
 // TLV field types
 #define TLV_FILESIZE 0
 #define TLV_FILENAME 1
+#define TLV_CODEC 2
+
+// Codecs a START packet can announce for the data packets that follow
+#define CODEC_NONE 0
+#define CODEC_LZ 1
+
+// Adaptive chunk sizing. Every CHUNK_EPOCH_FRAMES frames the byte error rate p
+// is re-estimated from the REJs and timeouts seen, and the chunk moves towards
+// the length L maximising L / (L + H) * (1 - p)^L, about sqrt(H / p), where H
+// is the per-frame overhead in bytes.
+#define CHUNK_EPOCH_FRAMES 16
+#define MIN_CHUNK_SIZE 64
+#define FRAME_OVERHEAD 20 // Packet header, frame header and flags, FCS, RR frame
+#define MAX_CHUNK_HISTORY 32
+
+// Bonded transfers. Data packets carry a 32-bit sequence number so the
+// receiver can put back in order what the links deliver out of order; up to
+// BOND_REORDER_SLOTS packets may wait for an earlier one.
+#define BONDED_HEADER_SIZE 7 // Type, sequence number, length
+#define BOND_REORDER_SLOTS 64
+#define BOND_POLL_MS 50
+
+// Data packets the transmitter's reader thread builds ahead of the link
+#define PREFETCH_SLOTS 8
+
+typedef struct {
+    long offset; // File offset where the new size took effect
+    int from;
+    int to;
+    double frame_error_rate;
+} ChunkChange;
+
+typedef struct {
+    int size;
+    int max_size;
+    int stop_and_wait;      // The RR wait adds to the overhead
+    int baud_rate;
+    LinkSession *session;   // NULL for the link opened with llopen()
+    // Errors and bytes sent, with each older epoch weighing a quarter less
+    double error_events;
+    double bytes_sent;
+    LinkStatistics epoch_start;
+    int changes;
+    ChunkChange history[MAX_CHUNK_HISTORY];
+} ChunkSizer;
+
+// One direction of a transfer's data packets, as announced in START
+typedef struct {
+    int codec;
+    LzStream *stream;   // Shared by every chunk, so matches reach into earlier ones
+    long bytes_in;      // File bytes
+    long bytes_out;     // Bytes carried in data packets
+    int chunks;
+    int chunks_raw;     // Chunks that did not shrink and went as they were
+    long position;      // File offset just past the last chunk
+} PacketCodec;
+
+// A data packet built ahead of the link
+typedef struct {
+    unsigned char *packet;
+    int length;
+    int data_len;           // File bytes it carries
+} PrefetchSlot;
+
+// Reader thread keeping a ring of data packets ready, so the link never
+// waits on storage
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+    FILE *file;
+    long remaining;         // File bytes not read yet
+    PacketCodec *codec;     // Only touched by the reader thread while it runs
+    int sequence;
+    int chunk_size;         // Set by the sender as it adapts
+    unsigned char *read_buffer; // Chunks waiting to be compressed
+    PrefetchSlot slots[PREFETCH_SLOTS];
+    int head;               // Oldest packet ready
+    int count;              // Packets ready
+    int stopping;
+} Prefetcher;
 
 // Helper structure for file transfer
 typedef struct {
@@ -27,7 +122,7 @@ typedef struct {
 // Control packet builders
 ////////////////////////////////////////////////
 static int build_control_packet(unsigned char type, const char *filename, 
-                                long file_size, unsigned char *packet) {
+                                long file_size, int codec, unsigned char *packet) {
     int idx = 0;
     packet[idx++] = type;
     
@@ -44,15 +139,24 @@ static int build_control_packet(unsigned char type, const char *filename,
     memcpy(&packet[idx], filename, name_len);
     idx += name_len;
     
+    // Announce the codec only when there is one, older receivers never see it
+    if (codec != CODEC_NONE) {
+        packet[idx++] = TLV_CODEC;
+        packet[idx++] = 1;
+        packet[idx++] = codec;
+    }
+    
     return idx;
 }
 
+// codec may be NULL when the caller has no use for it
 static int parse_control_packet(const unsigned char *packet, int length,
-                                char *filename, long *file_size) {
+                                char *filename, long *file_size, int *codec) {
     if (length < 1) return -1;
     
     unsigned char type = packet[0];
     if (type != PKT_TYPE_START && type != PKT_TYPE_END) return -1;
+    if (codec != NULL) *codec = CODEC_NONE;
     
     int idx = 1;
     while (idx < length) {
@@ -64,6 +168,8 @@ static int parse_control_packet(const unsigned char *packet, int length,
         } else if (tlv_type == TLV_FILENAME) {
             memcpy(filename, &packet[idx], tlv_len);
             filename[tlv_len] = '\0';
+        } else if (tlv_type == TLV_CODEC && tlv_len == 1 && codec != NULL) {
+            *codec = packet[idx];
         }
         
         idx += tlv_len;
@@ -75,48 +181,452 @@ static int parse_control_packet(const unsigned char *packet, int length,
 ////////////////////////////////////////////////
 // Data packet builders
 ////////////////////////////////////////////////
-static int build_data_packet(int seq_num, const unsigned char *data, 
-                            int data_len, unsigned char *packet) {
+
+// Data read straight into &packet[PLACED_HEADER_SIZE] is left where it is
+static int build_placed_packet(long offset, const unsigned char *data, 
+                               int data_len, unsigned char *packet) {
     int idx = 0;
-    packet[idx++] = PKT_TYPE_DATA;
-    packet[idx++] = seq_num % 256;
+    packet[idx++] = PKT_TYPE_PLACED_DATA;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        packet[idx++] = ((unsigned long)offset >> shift) & 0xFF;
+    }
     packet[idx++] = (data_len >> 8) & 0xFF;
     packet[idx++] = data_len & 0xFF;
-    memcpy(&packet[idx], data, data_len);
+    if (data != &packet[idx]) memcpy(&packet[idx], data, data_len);
     
     return idx + data_len;
 }
 
+static int is_data_packet(unsigned char type) {
+    return type == PKT_TYPE_DATA || type == PKT_TYPE_COMPRESSED_DATA ||
+           type == PKT_TYPE_PLACED_DATA;
+}
+
+////////////////////////////////////////////////
+// Compression
+////////////////////////////////////////////////
+static int init_packet_codec(PacketCodec *codec, int type) {
+    memset(codec, 0, sizeof(*codec));
+    codec->codec = type;
+    if (type == CODEC_NONE) return 0;
+    
+    if (type != CODEC_LZ) {
+        printf("Unsupported codec %d\n", type);
+        return -1;
+    }
+    codec->stream = lz_stream_new();
+    if (codec->stream == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    return 0;
+}
+
+static void free_packet_codec(PacketCodec *codec) {
+    lz_stream_free(codec->stream);
+    codec->stream = NULL;
+}
+
+// Build the data packet for the next chunk of the file: compressed if that
+// makes it smaller, otherwise placed at its file offset
+static int build_file_packet(PacketCodec *codec, int seq_num, const unsigned char *data,
+                             int data_len, unsigned char *packet) {
+    int packet_len = -1;
+    int header_size = DATA_HEADER_SIZE;
+    if (codec->stream != NULL) {
+        int packed = lz_compress(codec->stream, data, data_len, &packet[DATA_HEADER_SIZE], data_len - 1);
+        if (packed > 0) {
+            packet[0] = PKT_TYPE_COMPRESSED_DATA;
+            packet[1] = seq_num % 256;
+            packet[2] = (packed >> 8) & 0xFF;
+            packet[3] = packed & 0xFF;
+            packet_len = DATA_HEADER_SIZE + packed;
+        } else {
+            codec->chunks_raw++;
+        }
+    }
+    if (packet_len < 0) {
+        packet_len = build_placed_packet(codec->position, data, data_len, packet);
+        header_size = PLACED_HEADER_SIZE;
+    }
+    
+    codec->position += data_len;
+    codec->bytes_in += data_len;
+    codec->bytes_out += packet_len - header_size;
+    codec->chunks++;
+    return packet_len;
+}
+
+// Get the file bytes out of a data packet, decompressing them into scratch
+// when needed. Returns their length, with *data pointing at them and *offset
+// giving where they go in the file, or -1. Packets without an offset follow
+// the previous one.
+static int read_file_packet(PacketCodec *codec, const unsigned char *packet, int packet_len,
+                            unsigned char *scratch, int scratch_size, const unsigned char **data,
+                            long *offset) {
+    int header_size = packet[0] == PKT_TYPE_PLACED_DATA ? PLACED_HEADER_SIZE : DATA_HEADER_SIZE;
+    if (packet_len < header_size) return -1;
+    int data_len = (packet[header_size - 2] << 8) | packet[header_size - 1];
+    if (data_len + header_size > packet_len) {
+        printf("Invalid data length: %d (packet size: %d)\n", data_len, packet_len);
+        return -1;
+    }
+    
+    *offset = codec->position;
+    if (packet[0] == PKT_TYPE_PLACED_DATA) {
+        unsigned long placed = 0;
+        for (int i = 1; i <= 8; i++) placed = (placed << 8) | packet[i];
+        *offset = (long)placed;
+    }
+    
+    int length;
+    if (packet[0] != PKT_TYPE_COMPRESSED_DATA) {
+        // Raw chunks still belong to the history the sender compresses against
+        if (codec->stream != NULL) lz_append(codec->stream, &packet[header_size], data_len);
+        *data = &packet[header_size];
+        length = data_len;
+    } else if (codec->stream == NULL) {
+        printf("Compressed data packet, but no codec was announced\n");
+        return -1;
+    } else {
+        length = lz_decompress(codec->stream, &packet[header_size], data_len, scratch, scratch_size);
+        if (length < 0) {
+            printf("Corrupt compressed data packet\n");
+            return -1;
+        }
+        *data = scratch;
+    }
+    
+    codec->position = *offset + length;
+    return length;
+}
+
+////////////////////////////////////////////////
+// Output file
+////////////////////////////////////////////////
+
+// Reserve the whole file up front, so placed writes never extend it piece
+// by piece. Only a hint: file systems without fallocate() grow it as usual.
+static void preallocate_file(FILE *file, long size) {
+    if (size <= 0) return;
+    if (fallocate(fileno(file), 0, 0, size) < 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        perror("fallocate");
+    }
+}
+
+// Cut the file back to the bytes that arrived, so a short transfer does not
+// leave a full-size file with a zero-filled tail that passes for complete
+static void truncate_file(FILE *file, long size) {
+    fflush(file);
+    if (ftruncate(fileno(file), size) < 0) perror("ftruncate");
+}
+
+// Write a chunk at its offset, whatever order chunks arrive in
+static int place_file_data(FILE *file, long file_size, const unsigned char *data, int length,
+                           long offset) {
+    if (offset < 0 || offset + length > file_size) {
+        printf("Data packet for bytes %ld-%ld, past the end of the file\n", offset, offset + length);
+        return -1;
+    }
+    
+    int written = 0;
+    while (written < length) {
+        ssize_t n = pwrite(fileno(file), data + written, length - written, offset + written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("File write error");
+            return -1;
+        }
+        written += n;
+    }
+    return 0;
+}
+
+static void print_codec_statistics(const PacketCodec *codec) {
+    if (codec->codec == CODEC_NONE || codec->bytes_in == 0) return;
+    printf("Compression: %ld -> %ld bytes (%.1f%%), %d of %d chunks sent uncompressed\n",
+           codec->bytes_in, codec->bytes_out, codec->bytes_out * 100.0 / codec->bytes_in,
+           codec->chunks_raw, codec->chunks);
+}
+
+////////////////////////////////////////////////
+// Adaptive chunk sizing
+////////////////////////////////////////////////
+
+// Newton's method, so the build does not need libm
+static double square_root(double x) {
+    if (x <= 0) return 0;
+    double root = x > 1 ? x : 1;
+    for (int i = 0; i < 64; i++) {
+        root = 0.5 * (root + x / root);
+    }
+    return root;
+}
+
+static void read_link_statistics(const ChunkSizer *sizer, LinkStatistics *stats) {
+    if (sizer->session != NULL) {
+        llsession_statistics(sizer->session, stats);
+    } else {
+        llstatistics(stats);
+    }
+}
+
+static void init_chunk_sizer(ChunkSizer *sizer, const LinkLayer *link,
+                             LinkSession *session, int max_size) {
+    memset(sizer, 0, sizeof(*sizer));
+    sizer->max_size = max_size;
+    sizer->size = max_size < MAX_PAYLOAD_SIZE - 4 ? max_size : MAX_PAYLOAD_SIZE - 4;
+    sizer->stop_and_wait = link->options.arqMode == LlStopAndWait;
+    sizer->baud_rate = link->baudRate;
+    sizer->session = session;
+    read_link_statistics(sizer, &sizer->epoch_start);
+}
+
+static void update_chunk_size(ChunkSizer *sizer, long offset) {
+    LinkStatistics now;
+    read_link_statistics(sizer, &now);
+    
+    int frames = now.framesSent - sizer->epoch_start.framesSent;
+    if (frames < CHUNK_EPOCH_FRAMES) return;
+    
+    int errors = (now.rejects - sizer->epoch_start.rejects) +
+                 (now.timeouts - sizer->epoch_start.timeouts);
+    double fer = (double)errors / (frames + errors);
+    sizer->epoch_start = now;
+    
+    // Each error is taken as one corrupted byte, which holds while p * L is small
+    sizer->error_events = sizer->error_events * 0.75 + errors;
+    sizer->bytes_sent = sizer->bytes_sent * 0.75 +
+                        (double)(frames + errors) * (sizer->size + FRAME_OVERHEAD);
+    
+    double overhead = FRAME_OVERHEAD;
+    if (sizer->stop_and_wait) overhead += (double)now.rttMs * sizer->baud_rate / 10000;
+    
+    // Until an error shows up the rate is unknown and the size just doubles
+    long target = (long)sizer->size * 2;
+    if (sizer->error_events > 0) {
+        double p = sizer->error_events / sizer->bytes_sent;
+        long optimum = (long)square_root(overhead / p);
+        if (optimum < target) target = optimum;
+    }
+    if (target < MIN_CHUNK_SIZE) target = MIN_CHUNK_SIZE;
+    if (target > sizer->max_size) target = sizer->max_size;
+    
+    // Moves under 25% are not worth the noise
+    if (labs(target - sizer->size) * 4 < sizer->size) return;
+    
+    printf("\nChunk size %d -> %ld bytes (frame error rate %.1f%%)\n",
+           sizer->size, target, fer * 100);
+    if (sizer->changes < MAX_CHUNK_HISTORY) {
+        ChunkChange *change = &sizer->history[sizer->changes];
+        change->offset = offset;
+        change->from = sizer->size;
+        change->to = (int)target;
+        change->frame_error_rate = fer;
+    }
+    sizer->changes++;
+    sizer->size = (int)target;
+}
+
+static void print_chunk_statistics(const ChunkSizer *sizer) {
+    printf("\n=== Transfer Statistics ===\n");
+    printf("Final chunk size: %d bytes\n", sizer->size);
+    printf("Chunk size changes: %d\n", sizer->changes);
+    for (int i = 0; i < sizer->changes && i < MAX_CHUNK_HISTORY; i++) {
+        const ChunkChange *change = &sizer->history[i];
+        printf("  at byte %ld: %d -> %d (frame error rate %.1f%%)\n", change->offset,
+               change->from, change->to, change->frame_error_rate * 100);
+    }
+    if (sizer->changes > MAX_CHUNK_HISTORY) {
+        printf("  (%d more not shown)\n", sizer->changes - MAX_CHUNK_HISTORY);
+    }
+}
+
+////////////////////////////////////////////////
+// Prefetched file source
+////////////////////////////////////////////////
+static void *prefetch_file(void *arg) {
+    Prefetcher *prefetcher = arg;
+    pthread_mutex_lock(&prefetcher->lock);
+    
+    while (prefetcher->remaining > 0 && !prefetcher->stopping) {
+        if (prefetcher->count == PREFETCH_SLOTS) {
+            pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+            continue;
+        }
+        
+        PrefetchSlot *slot = &prefetcher->slots[(prefetcher->head + prefetcher->count) % PREFETCH_SLOTS];
+        int to_read = prefetcher->remaining > prefetcher->chunk_size ? prefetcher->chunk_size
+                                                                     : prefetcher->remaining;
+        int sequence = prefetcher->sequence++;
+        prefetcher->remaining -= to_read;
+        
+        // The slot is not visible to the sender until count moves, so the
+        // disk is read without the lock held
+        pthread_mutex_unlock(&prefetcher->lock);
+        
+        // Uncompressed chunks are read straight into the packet
+        PacketCodec *codec = prefetcher->codec;
+        unsigned char *chunk = codec->stream != NULL ? prefetcher->read_buffer
+                                                    : &slot->packet[PLACED_HEADER_SIZE];
+        int bytes_read = fread(chunk, 1, to_read, prefetcher->file);
+        if (bytes_read == to_read) {
+            slot->length = build_file_packet(codec, sequence, chunk, bytes_read, slot->packet);
+            slot->data_len = bytes_read;
+        }
+        
+        pthread_mutex_lock(&prefetcher->lock);
+        if (bytes_read != to_read) {
+            if (ferror(prefetcher->file)) {
+                perror("File read error");
+            } else {
+                printf("File read error: file ended %d bytes early\n", to_read - bytes_read);
+            }
+            break;
+        }
+        prefetcher->count++;
+        pthread_cond_broadcast(&prefetcher->changed);
+    }
+    
+    // Ends the sender's wait for a packet that will never come
+    prefetcher->remaining = 0;
+    pthread_cond_broadcast(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+    return NULL;
+}
+
+static int start_prefetcher(Prefetcher *prefetcher, FILE *file, long file_size,
+                            PacketCodec *codec, int chunk_size, int packet_size) {
+    memset(prefetcher, 0, sizeof(*prefetcher));
+    prefetcher->file = file;
+    prefetcher->remaining = file_size;
+    prefetcher->codec = codec;
+    prefetcher->chunk_size = chunk_size;
+    
+    prefetcher->read_buffer = malloc(packet_size);
+    int ok = prefetcher->read_buffer != NULL;
+    for (int i = 0; i < PREFETCH_SLOTS && ok; i++) {
+        prefetcher->slots[i].packet = malloc(packet_size);
+        ok = prefetcher->slots[i].packet != NULL;
+    }
+    if (!ok) {
+        perror("malloc");
+    }
+    
+    // Ask the kernel to read ahead of us as well
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->changed, NULL);
+    if (ok && pthread_create(&prefetcher->thread, NULL, prefetch_file, prefetcher) != 0) {
+        printf("Cannot start the file reader thread\n");
+        ok = FALSE;
+    }
+    if (!ok) {
+        pthread_cond_destroy(&prefetcher->changed);
+        pthread_mutex_destroy(&prefetcher->lock);
+        for (int i = 0; i < PREFETCH_SLOTS; i++) free(prefetcher->slots[i].packet);
+        free(prefetcher->read_buffer);
+        return -1;
+    }
+    return 0;
+}
+
+// Oldest packet ready, waiting for the reader if need be. Returns NULL once
+// the file is exhausted or could not be read; packets read before an error
+// still come first. The chunk size applies to packets read from now on.
+static PrefetchSlot *next_prefetched_packet(Prefetcher *prefetcher, int chunk_size) {
+    PrefetchSlot *slot = NULL;
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->chunk_size = chunk_size;
+    
+    while (prefetcher->count == 0 && prefetcher->remaining > 0) {
+        pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+    }
+    if (prefetcher->count > 0) {
+        slot = &prefetcher->slots[prefetcher->head];
+    }
+    
+    pthread_mutex_unlock(&prefetcher->lock);
+    return slot;
+}
+
+// Hand the oldest packet's slot back to the reader
+static void release_prefetched_packet(Prefetcher *prefetcher) {
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->head = (prefetcher->head + 1) % PREFETCH_SLOTS;
+    prefetcher->count--;
+    pthread_cond_broadcast(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+static void stop_prefetcher(Prefetcher *prefetcher) {
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->stopping = TRUE;
+    pthread_cond_broadcast(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+    
+    pthread_join(prefetcher->thread, NULL);
+    pthread_cond_destroy(&prefetcher->changed);
+    pthread_mutex_destroy(&prefetcher->lock);
+    for (int i = 0; i < PREFETCH_SLOTS; i++) free(prefetcher->slots[i].packet);
+    free(prefetcher->read_buffer);
+}
+
 ////////////////////////////////////////////////
 // File operations
 ////////////////////////////////////////////////
-static int send_file_contents(int fd, FILE *file, long file_size) {
-    unsigned char read_buffer[MAX_PAYLOAD_SIZE - 4];
-    unsigned char packet_buffer[MAX_PAYLOAD_SIZE];
+
+// Hand a packet to the link once the window has room. Only room is waited
+// for, not the acknowledgement, so the next chunk is read from the file
+// while this one is on the wire.
+static int submit_packet(const unsigned char *packet, int length) {
+    int result;
+    while ((result = llsubmit(packet, length)) == 0) {
+        LinkEvents events;
+        if (llpoll(-1, &events) < 0) return -1;
+    }
+    return result;
+}
+
+static int send_file_contents(int fd, FILE *file, long file_size, const LinkLayer *link,
+                              PacketCodec *codec) {
+    // Buffers follow the payload size negotiated in llopen(); the chunk
+    // actually sent adapts to the error rate below that ceiling
+    int packet_size = llmaxpayload();
+    ChunkSizer sizer;
+    init_chunk_sizer(&sizer, link, NULL, packet_size - PLACED_HEADER_SIZE);
     long bytes_sent = 0;
-    int sequence = 0;
+    int result = 0;
+    
+    // A reader thread keeps packets ready ahead of the link
+    Prefetcher prefetcher;
+    if (start_prefetcher(&prefetcher, file, file_size, codec, sizer.size, packet_size) < 0) {
+        return -1;
+    }
     
     printf("Starting file transfer...\n");
     
     while (bytes_sent < file_size) {
-        int to_read = (file_size - bytes_sent > sizeof(read_buffer)) ? 
-                      sizeof(read_buffer) : (file_size - bytes_sent);
-        
-        int bytes_read = fread(read_buffer, 1, to_read, file);
-        if (bytes_read <= 0) {
-            perror("File read error");
-            return -1;
+        PrefetchSlot *slot = next_prefetched_packet(&prefetcher, sizer.size);
+        if (slot == NULL) {
+            printf("Transfer stopped at %ld/%ld bytes: the file could not be read\n",
+                   bytes_sent, file_size);
+            result = -1;
+            break;
         }
         
-        int packet_len = build_data_packet(sequence++, read_buffer, 
-                                          bytes_read, packet_buffer);
-        
-        if (llwrite(packet_buffer, packet_len) < 0) {
-            printf("Transfer failed at sequence %d\n", sequence - 1);
-            return -1;
+        int submitted = submit_packet(slot->packet, slot->length);
+        int bytes_read = slot->data_len;
+        release_prefetched_packet(&prefetcher);
+        if (submitted < 0) {
+            printf("Transfer failed at %ld/%ld bytes\n", bytes_sent, file_size);
+            result = -1;
+            break;
         }
         
         bytes_sent += bytes_read;
+        update_chunk_size(&sizer, bytes_sent);
         
         if (bytes_sent % 10240 == 0 || bytes_sent == file_size) {
             printf("\rProgress: %ld/%ld bytes (%.1f%%)", 
@@ -126,17 +636,30 @@ static int send_file_contents(int fd, FILE *file, long file_size) {
         }
     }
     
+    stop_prefetcher(&prefetcher);
     printf("\n");
-    return 0;
+    print_chunk_statistics(&sizer);
+    print_codec_statistics(codec);
+    return result;
 }
 
-static int receive_file_contents(int fd, FILE *file, long expected_size) {
-    unsigned char packet_buffer[MAX_PAYLOAD_SIZE * 2];
+static int receive_file_contents(int fd, FILE *file, long expected_size, PacketCodec *codec) {
+    int packet_size = llmaxpayload();
+    unsigned char *packet_buffer = malloc(packet_size);
+    unsigned char *chunk_buffer = malloc(packet_size);
     long bytes_received = 0;
     int timeout_count = 0;
     const int MAX_TIMEOUTS = 10;
     
+    if (packet_buffer == NULL || chunk_buffer == NULL) {
+        perror("malloc");
+        free(packet_buffer);
+        free(chunk_buffer);
+        return -1;
+    }
+    
     printf("Receiving file data...\n");
+    preallocate_file(file, expected_size);
     
     while (bytes_received < expected_size && timeout_count < MAX_TIMEOUTS) {
         int packet_len = llread(packet_buffer);
@@ -159,22 +682,28 @@ static int receive_file_contents(int fd, FILE *file, long expected_size) {
             break;
         }
         
-        if (packet_buffer[0] != PKT_TYPE_DATA) {
+        if (!is_data_packet(packet_buffer[0])) {
             printf("Unexpected packet type: %d\n", packet_buffer[0]);
             continue;
         }
         
         // Parse data packet
-        int data_len = (packet_buffer[2] << 8) | packet_buffer[3];
+        const unsigned char *data;
+        long offset;
+        int data_len = read_file_packet(codec, packet_buffer, packet_len,
+                                        chunk_buffer, packet_size, &data, &offset);
+        if (data_len < 0) continue;
         
-        if (data_len + 4 > packet_len) {
-            printf("Invalid data length: %d (packet size: %d)\n", data_len, packet_len);
-            continue;
-        }
+        // Acknowledge what arrived meanwhile, so the sender carries on while
+        // the file is written
+        LinkEvents events;
+        llpoll(0, &events);
         
-        // Write to file
-        if (fwrite(&packet_buffer[4], 1, data_len, file) != (size_t)data_len) {
-            perror("File write error");
+        // Write it where it belongs in the file
+        if (place_file_data(file, expected_size, data, data_len, offset) < 0) {
+            free(packet_buffer);
+            free(chunk_buffer);
+            truncate_file(file, bytes_received);
             return -1;
         }
         
@@ -190,26 +719,638 @@ static int receive_file_contents(int fd, FILE *file, long expected_size) {
     }
     
     printf("\n");
+    free(packet_buffer);
+    free(chunk_buffer);
     
     if (bytes_received < expected_size) {
         printf("Warning: Received %ld bytes, expected %ld\n", 
                bytes_received, expected_size);
+        truncate_file(file, bytes_received);
+        return -1;
     }
     
-    return (bytes_received > 0) ? 0 : -1;
+    return 0;
 }
+// Send one file and receive another over a duplex link at the same time.
+// Each data packet sent is followed by whatever packets have arrived; once
+// our file is out, the rest of the incoming one is awaited.
+static int transfer_duplex(const char *send_name, const char *receive_name,
+                           const LinkLayer *link, int codec) {
+    FILE *out_file = fopen(send_name, "rb");
+    FILE *in_file = fopen(receive_name, "wb");
+    int packet_size = llmaxpayload();
+    unsigned char *read_buffer = malloc(packet_size);
+    unsigned char *packet = malloc(packet_size);
+    unsigned char *chunk_buffer = malloc(packet_size);
+    PacketCodec out_codec = {0};
+    PacketCodec in_codec = {0};
+    long bytes_received = 0;
+    long expected_size = 0;
+    int result = -1;
+    
+    if (out_file == NULL || in_file == NULL || read_buffer == NULL || packet == NULL ||
+        chunk_buffer == NULL) {
+        perror("Cannot start duplex transfer");
+        goto cleanup;
+    }
+    if (init_packet_codec(&out_codec, codec) < 0) goto cleanup;
+    
+    struct stat file_stat;
+    stat(send_name, &file_stat);
+    long file_size = file_stat.st_size;
+    
+    printf("Sending file: %s (%ld bytes), receiving into %s\n", send_name, file_size, receive_name);
+    
+    ChunkSizer sizer;
+    init_chunk_sizer(&sizer, link, NULL, packet_size - PLACED_HEADER_SIZE);
+    
+    int ctrl_len = build_control_packet(PKT_TYPE_START, send_name, file_size, codec, packet);
+    if (llwrite(packet, ctrl_len) < 0) goto cleanup;
+    
+    long bytes_sent = 0;
+    int sequence = 0;
+    int sending = TRUE;
+    int receiving = TRUE;
+    
+    while (sending || receiving) {
+        if (sending && bytes_sent < file_size) {
+            int to_read = (file_size - bytes_sent > sizer.size) ? 
+                          sizer.size : (file_size - bytes_sent);
+            unsigned char *chunk = out_codec.stream != NULL ? read_buffer : &packet[PLACED_HEADER_SIZE];
+            int bytes_read = fread(chunk, 1, to_read, out_file);
+            if (bytes_read <= 0) {
+                perror("File read error");
+                goto cleanup;
+            }
+            
+            int packet_len = build_file_packet(&out_codec, sequence++, chunk, bytes_read, packet);
+            if (llwrite(packet, packet_len) < 0) {
+                printf("Transfer failed at sequence %d\n", sequence - 1);
+                goto cleanup;
+            }
+            bytes_sent += bytes_read;
+            update_chunk_size(&sizer, bytes_sent);
+        } else if (sending) {
+            ctrl_len = build_control_packet(PKT_TYPE_END, send_name, file_size, codec, packet);
+            if (llwrite(packet, ctrl_len) < 0) goto cleanup;
+            sending = FALSE;
+            printf("\nFile sent, %ld bytes\n", bytes_sent);
+        }
+        
+        while (receiving && (!sending || llpending() != 0)) {
+            int packet_len = llread(packet);
+            if (packet_len <= 0) {
+                printf("Link closed before the incoming file was complete\n");
+                goto cleanup;
+            }
+            
+            if (packet[0] == PKT_TYPE_START) {
+                char remote_name[256];
+                int remote_codec;
+                parse_control_packet(packet, packet_len, remote_name, &expected_size, &remote_codec);
+                printf("Receiving file: %s (%ld bytes)\n", remote_name, expected_size);
+                preallocate_file(in_file, expected_size);
+                free_packet_codec(&in_codec);
+                if (init_packet_codec(&in_codec, remote_codec) < 0) goto cleanup;
+            } else if (packet[0] == PKT_TYPE_END) {
+                receiving = FALSE;
+                printf("\nFile received, %ld/%ld bytes\n", bytes_received, expected_size);
+            } else if (is_data_packet(packet[0])) {
+                const unsigned char *data;
+                long offset;
+                int data_len = read_file_packet(&in_codec, packet, packet_len,
+                                                chunk_buffer, packet_size, &data, &offset);
+                if (data_len < 0) continue;
+                if (place_file_data(in_file, expected_size, data, data_len, offset) < 0) {
+                    goto cleanup;
+                }
+                bytes_received += data_len;
+            }
+        }
+        
+        printf("\rSent: %ld/%ld bytes, received: %ld/%ld bytes    ",
+               bytes_sent, file_size, bytes_received, expected_size);
+        fflush(stdout);
+    }
+    
+    print_chunk_statistics(&sizer);
+    print_codec_statistics(&out_codec);
+    if (bytes_received == expected_size) {
+        result = 0;
+    } else {
+        printf("Warning: Received %ld bytes, expected %ld\n", bytes_received, expected_size);
+    }
+    
+cleanup:
+    if (out_file != NULL) fclose(out_file);
+    if (in_file != NULL) {
+        if (result < 0) truncate_file(in_file, bytes_received);
+        fclose(in_file);
+    }
+    free(read_buffer);
+    free(packet);
+    free(chunk_buffer);
+    free_packet_codec(&out_codec);
+    free_packet_codec(&in_codec);
+    return result;
+}
+
+////////////////////////////////////////////////
+// Bonded transfers
+////////////////////////////////////////////////
+typedef struct BondedTransfer BondedTransfer;
+
+typedef struct {
+    BondedTransfer *bond;
+    LinkLayer config;
+    LinkSession *session;
+    pthread_t thread;
+    long bytes;             // Data bytes carried by this link
+    int packets;
+    double started;         // Seconds, once the link is open
+    double finished;
+    int chunk_size;         // Final adaptive chunk size (tx)
+    int failed;
+    LinkStatistics stats;   // Taken just before the link closes
+} BondLink;
+
+typedef struct {
+    int filled;
+    int length;
+    unsigned char *data;
+} ReorderEntry;
+
+struct BondedTransfer {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    const char *filename;
+    FILE *file;
+    long file_size;
+    int aborted;
+    int link_count;
+    BondLink links[MAX_BOND_LINKS];
+    // Transmitter: next chunk of the file to hand out
+    long next_offset;
+    unsigned int next_sequence;
+    // Receiver: packets waiting for an earlier one, indexed by sequence number
+    ReorderEntry reorder[BOND_REORDER_SLOTS];
+    unsigned int next_expected;
+    int links_running;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double link_rate(const BondLink *link, double now) {
+    if (link->failed || link->started == 0 || now <= link->started) return 0;
+    return link->bytes / (now - link->started);
+}
+
+static void abort_bond(BondedTransfer *bond) {
+    pthread_mutex_lock(&bond->lock);
+    bond->aborted = TRUE;
+    pthread_cond_broadcast(&bond->changed);
+    pthread_mutex_unlock(&bond->lock);
+}
+
+// Links pull chunks as fast as their window drains, so each gets a share of
+// the file in proportion to its throughput. Near the end a link passes on a
+// chunk if a faster one would get all the remaining data out before this one
+// finished that chunk alone, so a slow cable does not hold up the transfer.
+static int should_take_chunk(const BondedTransfer *bond, const BondLink *link,
+                             int chunk, long remaining, double now) {
+    double own = link_rate(link, now);
+    if (own <= 0) return TRUE;
+    
+    for (int i = 0; i < bond->link_count; i++) {
+        double rate = link_rate(&bond->links[i], now);
+        if (rate > own && remaining / rate < chunk / own) return FALSE;
+    }
+    return TRUE;
+}
+
+// Read a claimed chunk of the file at its offset. pread() leaves the shared
+// file position alone, so links read their chunks in parallel.
+static int read_bonded_chunk(BondedTransfer *bond, unsigned char *data, int length, long offset) {
+    int done = 0;
+    while (done < length) {
+        ssize_t n = pread(fileno(bond->file), data + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n < 0) {
+                perror("File read error");
+            } else {
+                printf("File read error: file ended %d bytes early\n", length - done);
+            }
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// Build the next data packet for a link. Returns its length, 0 once the file
+// has been handed out, or -1 if the transfer was aborted. The lock is only
+// held to claim the chunk; the disk is read after letting go of it.
+static int next_bonded_packet(BondedTransfer *bond, BondLink *link, int chunk,
+                              unsigned char *packet) {
+    int to_read = 0;
+    long offset = 0;
+    unsigned int sequence = 0;
+    pthread_mutex_lock(&bond->lock);
+    
+    while (!bond->aborted) {
+        long remaining = bond->file_size - bond->next_offset;
+        if (remaining <= 0) break;
+        
+        int size = remaining > chunk ? chunk : remaining;
+        if (should_take_chunk(bond, link, size, remaining, now_seconds())) {
+            to_read = size;
+            offset = bond->next_offset;
+            sequence = bond->next_sequence++;
+            bond->next_offset += to_read;
+            link->bytes += to_read;
+            link->packets++;
+            break;
+        }
+        
+        // Rates keep moving while we wait, so look again shortly
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += BOND_POLL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&bond->changed, &bond->lock, &deadline);
+    }
+    
+    int aborted = bond->aborted;
+    pthread_mutex_unlock(&bond->lock);
+    if (aborted) return -1;
+    if (to_read == 0) return 0;
+    
+    if (read_bonded_chunk(bond, &packet[BONDED_HEADER_SIZE], to_read, offset) < 0) {
+        pthread_mutex_lock(&bond->lock);
+        link->bytes -= to_read;
+        link->packets--;
+        pthread_mutex_unlock(&bond->lock);
+        abort_bond(bond);
+        return -1;
+    }
+    
+    packet[0] = PKT_TYPE_BONDED_DATA;
+    packet[1] = (sequence >> 24) & 0xFF;
+    packet[2] = (sequence >> 16) & 0xFF;
+    packet[3] = (sequence >> 8) & 0xFF;
+    packet[4] = sequence & 0xFF;
+    packet[5] = (to_read >> 8) & 0xFF;
+    packet[6] = to_read & 0xFF;
+    return BONDED_HEADER_SIZE + to_read;
+}
+
+static void *bonded_sender(void *arg) {
+    BondLink *link = arg;
+    BondedTransfer *bond = link->bond;
+    const char *port = link->config.serialPort;
+    
+    link->session = llsession_open(link->config);
+    if (link->session == NULL) {
+        printf("Connection failed on %s\n", port);
+        link->failed = TRUE;
+        abort_bond(bond);
+        return NULL;
+    }
+    printf("Connection established on %s\n", port);
+    
+    int packet_size = llsession_maxpayload(link->session);
+    unsigned char *packet = malloc(packet_size);
+    ChunkSizer sizer;
+    init_chunk_sizer(&sizer, &link->config, link->session, packet_size - BONDED_HEADER_SIZE);
+    
+    if (packet == NULL) {
+        perror("malloc");
+        link->failed = TRUE;
+    } else if (link == &bond->links[0]) {
+        // The first link announces the file
+        int ctrl_len = build_control_packet(PKT_TYPE_START, bond->filename,
+                                            bond->file_size, CODEC_NONE, packet);
+        if (llsession_write(link->session, packet, ctrl_len) < 0) link->failed = TRUE;
+    }
+    
+    pthread_mutex_lock(&bond->lock);
+    link->started = now_seconds();
+    pthread_mutex_unlock(&bond->lock);
+    
+    while (!link->failed) {
+        int packet_len = next_bonded_packet(bond, link, sizer.size, packet);
+        if (packet_len < 0) link->failed = TRUE;
+        if (packet_len <= 0) break;
+        
+        if (llsession_write(link->session, packet, packet_len) < 0) {
+            printf("Transfer failed on %s\n", port);
+            link->failed = TRUE;
+            break;
+        }
+        update_chunk_size(&sizer, link->bytes);
+    }
+    
+    if (!link->failed && link == &bond->links[0]) {
+        int ctrl_len = build_control_packet(PKT_TYPE_END, bond->filename,
+                                            bond->file_size, CODEC_NONE, packet);
+        if (llsession_write(link->session, packet, ctrl_len) < 0) link->failed = TRUE;
+    }
+    if (link->failed) abort_bond(bond);
+    
+    link->finished = now_seconds();
+    link->chunk_size = sizer.size;
+    llsession_statistics(link->session, &link->stats);
+    if (llsession_close(link->session, 0) < 0) link->failed = TRUE;
+    link->session = NULL;
+    free(packet);
+    return NULL;
+}
+
+// Hand a received packet to the writer, waiting while it is too far ahead
+static int deliver_bonded_packet(BondedTransfer *bond, unsigned int sequence,
+                                 const unsigned char *data, int length) {
+    int result = -1;
+    pthread_mutex_lock(&bond->lock);
+    
+    // Anything behind the writer is a duplicate
+    if ((int)(sequence - bond->next_expected) < 0) {
+        pthread_mutex_unlock(&bond->lock);
+        return 0;
+    }
+    while (!bond->aborted && sequence - bond->next_expected >= BOND_REORDER_SLOTS) {
+        pthread_cond_wait(&bond->changed, &bond->lock);
+    }
+    
+    ReorderEntry *entry = &bond->reorder[sequence % BOND_REORDER_SLOTS];
+    if (!bond->aborted && !entry->filled) {
+        entry->data = malloc(length);
+        if (entry->data == NULL) {
+            perror("malloc");
+            bond->aborted = TRUE;
+        } else {
+            memcpy(entry->data, data, length);
+            entry->length = length;
+            entry->filled = TRUE;
+            result = 0;
+        }
+        pthread_cond_broadcast(&bond->changed);
+    } else if (!bond->aborted) {
+        result = 0;
+    }
+    
+    pthread_mutex_unlock(&bond->lock);
+    return result;
+}
+
+static void *bonded_receiver(void *arg) {
+    BondLink *link = arg;
+    BondedTransfer *bond = link->bond;
+    const char *port = link->config.serialPort;
+    unsigned char *packet = NULL;
+    
+    link->session = llsession_open(link->config);
+    if (link->session == NULL) {
+        printf("Connection failed on %s\n", port);
+        link->failed = TRUE;
+        abort_bond(bond);
+    } else {
+        printf("Connection established on %s\n", port);
+        link->started = now_seconds();
+        packet = malloc(llsession_maxpayload(link->session));
+        if (packet == NULL) {
+            perror("malloc");
+            link->failed = TRUE;
+        }
+    }
+    
+    while (!link->failed) {
+        int packet_len = llsession_read(link->session, packet);
+        if (packet_len == 0) break; // DISC, this link is done
+        if (packet_len < 0) {
+            printf("Link on %s failed\n", port);
+            link->failed = TRUE;
+            break;
+        }
+        
+        if (packet[0] == PKT_TYPE_START) {
+            char remote_name[256];
+            long file_size = 0;
+            parse_control_packet(packet, packet_len, remote_name, &file_size, NULL);
+            printf("Receiving file: %s (%ld bytes)\n", remote_name, file_size);
+            pthread_mutex_lock(&bond->lock);
+            bond->file_size = file_size;
+            pthread_mutex_unlock(&bond->lock);
+        } else if (packet[0] == PKT_TYPE_BONDED_DATA && packet_len >= BONDED_HEADER_SIZE) {
+            unsigned int sequence = ((unsigned int)packet[1] << 24) | (packet[2] << 16) |
+                                    (packet[3] << 8) | packet[4];
+            int data_len = (packet[5] << 8) | packet[6];
+            if (data_len + BONDED_HEADER_SIZE > packet_len) {
+                printf("Invalid data length: %d (packet size: %d)\n", data_len, packet_len);
+                continue;
+            }
+            if (deliver_bonded_packet(bond, sequence, &packet[BONDED_HEADER_SIZE], data_len) < 0) {
+                break;
+            }
+            link->bytes += data_len;
+            link->packets++;
+        }
+    }
+    
+    link->finished = now_seconds();
+    if (link->failed) abort_bond(bond);
+    if (link->session != NULL) {
+        llsession_statistics(link->session, &link->stats);
+        if (llsession_close(link->session, 0) < 0) link->failed = TRUE;
+        link->session = NULL;
+    }
+    free(packet);
+    
+    pthread_mutex_lock(&bond->lock);
+    bond->links_running--;
+    pthread_cond_broadcast(&bond->changed);
+    pthread_mutex_unlock(&bond->lock);
+    return NULL;
+}
+
+// Write packets out in sequence order until every link has disconnected
+static long write_bonded_packets(BondedTransfer *bond) {
+    long written = 0;
+    pthread_mutex_lock(&bond->lock);
+    
+    for (;;) {
+        ReorderEntry *entry = &bond->reorder[bond->next_expected % BOND_REORDER_SLOTS];
+        if (entry->filled) {
+            unsigned char *data = entry->data;
+            int length = entry->length;
+            entry->filled = FALSE;
+            entry->data = NULL;
+            bond->next_expected++;
+            pthread_cond_broadcast(&bond->changed);
+            
+            pthread_mutex_unlock(&bond->lock);
+            size_t stored = fwrite(data, 1, length, bond->file);
+            free(data);
+            pthread_mutex_lock(&bond->lock);
+            
+            if (stored != (size_t)length) {
+                perror("File write error");
+                bond->aborted = TRUE;
+                pthread_cond_broadcast(&bond->changed);
+                break;
+            }
+            written += length;
+            if (bond->file_size > 0) {
+                printf("\rReceived: %ld/%ld bytes (%.1f%%)    ", written, bond->file_size,
+                       (written * 100.0) / bond->file_size);
+                fflush(stdout);
+            }
+        } else if (bond->links_running == 0 || bond->aborted) {
+            break;
+        } else {
+            pthread_cond_wait(&bond->changed, &bond->lock);
+        }
+    }
+    
+    pthread_mutex_unlock(&bond->lock);
+    printf("\n");
+    return written;
+}
+
+static void print_bond_statistics(const BondedTransfer *bond, LinkLayerRole role) {
+    long total = 0;
+    for (int i = 0; i < bond->link_count; i++) total += bond->links[i].bytes;
+    
+    printf("\n=== Bond Statistics ===\n");
+    for (int i = 0; i < bond->link_count; i++) {
+        const BondLink *link = &bond->links[i];
+        double elapsed = link->finished - link->started;
+        printf("%s: %ld bytes in %d packets (%.1f%%), %.0f bytes/s%s\n",
+               link->config.serialPort, link->bytes, link->packets,
+               total > 0 ? link->bytes * 100.0 / total : 0.0,
+               elapsed > 0 ? link->bytes / elapsed : 0.0,
+               link->failed ? ", failed" : "");
+        if (role == LlTx && link->started > 0) {
+            printf("  chunk %d bytes, %d frames, %d retransmitted, %d REJ, %d timeouts\n",
+                   link->chunk_size, link->stats.framesSent, link->stats.retransmissions,
+                   link->stats.rejects, link->stats.timeouts);
+        }
+    }
+}
+
+// Send or receive one file striped across the main port and the bonded ones.
+// Every link runs its own session in a thread of its own.
+static int transfer_bonded(const char *filename, const LinkLayer *link_config,
+                           const ApplicationOptions *options) {
+    BondedTransfer *bond = calloc(1, sizeof(*bond));
+    if (bond == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    pthread_mutex_init(&bond->lock, NULL);
+    pthread_cond_init(&bond->changed, NULL);
+    bond->filename = filename;
+    bond->link_count = options->bondPortCount + 1;
+    
+    for (int i = 0; i < bond->link_count; i++) {
+        BondLink *link = &bond->links[i];
+        link->bond = bond;
+        link->config = *link_config;
+        if (i > 0) {
+            memset(link->config.serialPort, 0, sizeof(link->config.serialPort));
+            strncpy(link->config.serialPort, options->bondPorts[i - 1],
+                    sizeof(link->config.serialPort) - 1);
+        }
+    }
+    
+    int result = -1;
+    if (link_config->role == LlTx) {
+        bond->file = fopen(filename, "rb");
+        if (bond->file == NULL) {
+            perror("Cannot open file");
+            goto cleanup;
+        }
+        struct stat file_stat;
+        stat(filename, &file_stat);
+        bond->file_size = file_stat.st_size;
+        printf("Sending file: %s (%ld bytes) over %d links\n", filename,
+               bond->file_size, bond->link_count);
+    } else {
+        bond->file = fopen(filename, "wb");
+        if (bond->file == NULL) {
+            perror("Cannot create file");
+            goto cleanup;
+        }
+    }
+    
+    int started = 0;
+    bond->links_running = bond->link_count;
+    for (; started < bond->link_count; started++) {
+        BondLink *link = &bond->links[started];
+        if (pthread_create(&link->thread, NULL,
+                           link_config->role == LlTx ? bonded_sender : bonded_receiver,
+                           link) != 0) {
+            printf("Cannot start the thread for %s\n", link->config.serialPort);
+            pthread_mutex_lock(&bond->lock);
+            bond->links_running -= bond->link_count - started;
+            pthread_mutex_unlock(&bond->lock);
+            abort_bond(bond);
+            break;
+        }
+    }
+    
+    long received = 0;
+    if (link_config->role == LlRx) received = write_bonded_packets(bond);
+    for (int i = 0; i < started; i++) pthread_join(bond->links[i].thread, NULL);
+    
+    print_bond_statistics(bond, link_config->role);
+    if (link_config->role == LlTx) {
+        result = bond->aborted ? -1 : 0;
+        printf("%s\n", result == 0 ? "File sent successfully" : "File transfer failed");
+    } else {
+        result = received == bond->file_size && !bond->aborted ? 0 : -1;
+        if (result == 0) {
+            printf("File received successfully\n");
+        } else {
+            printf("Warning: Received %ld bytes, expected %ld\n", received, bond->file_size);
+        }
+    }
+    
+cleanup:
+    if (bond->file != NULL) fclose(bond->file);
+    for (int i = 0; i < BOND_REORDER_SLOTS; i++) free(bond->reorder[i].data);
+    pthread_cond_destroy(&bond->changed);
+    pthread_mutex_destroy(&bond->lock);
+    free(bond);
+    return result;
+}
+
 ////////////////////////////////////////////////
 // Public API
 ////////////////////////////////////////////////
 void applicationLayer(const char *serialPort, const char *role, 
                      int baudRate, int nTries, int timeout, 
-                     const char *filename) {
+                     const char *filename, const ApplicationOptions *options) {
     LinkLayer link_config;
+    memset(&link_config, 0, sizeof(link_config));
     strncpy(link_config.serialPort, serialPort, sizeof(link_config.serialPort) - 1);
     link_config.role = (strcmp(role, "tx") == 0) ? LlTx : LlRx;
     link_config.baudRate = baudRate;
     link_config.nRetransmissions = nTries;
     link_config.timeout = timeout;
+    if (options != NULL) {
+        link_config.options = options->link;
+    }
+    
+    if (options != NULL && options->bondPortCount > 0) {
+        transfer_bonded(filename, &link_config, options);
+        return;
+    }
     
     int fd = llopen(link_config);
     if (fd < 0) {
@@ -219,7 +1360,20 @@ void applicationLayer(const char *serialPort, const char *role,
     
     printf("Connection established on %s\n", serialPort);
     
-    if (link_config.role == LlTx) {
+    LinkOptions agreed;
+    llgetoptions(&agreed);
+    
+    // The sender picks the codec and announces it in START
+    int codec = (options != NULL && options->compress) ? CODEC_LZ : CODEC_NONE;
+    
+    if (agreed.duplex) {
+        // Both ends send a file; the receiver's comes back into duplexFile
+        if (link_config.role == LlTx) {
+            transfer_duplex(filename, options->duplexFile, &link_config, codec);
+        } else {
+            transfer_duplex(options->duplexFile, filename, &link_config, codec);
+        }
+    } else if (link_config.role == LlTx) {
         // Transmitter mode
         FILE *file = fopen(filename, "rb");
         if (!file) {
@@ -234,35 +1388,52 @@ void applicationLayer(const char *serialPort, const char *role,
         
         printf("Sending file: %s (%ld bytes)\n", filename, file_size);
         
+        PacketCodec packet_codec;
+        if (init_packet_codec(&packet_codec, codec) < 0) {
+            fclose(file);
+            llclose(1);
+            return;
+        }
+        
         // Send start control packet
         unsigned char ctrl_packet[MAX_PAYLOAD_SIZE];
         int ctrl_len = build_control_packet(PKT_TYPE_START, filename, 
-                                           file_size, ctrl_packet);
+                                           file_size, codec, ctrl_packet);
         llwrite(ctrl_packet, ctrl_len);
         
         // Send file data
-        send_file_contents(fd, file, file_size);
+        int result = send_file_contents(fd, file, file_size, &link_config, &packet_codec);
         
         // Send end control packet
         ctrl_len = build_control_packet(PKT_TYPE_END, filename, 
-                                       file_size, ctrl_packet);
-        llwrite(ctrl_packet, ctrl_len);
+                                       file_size, codec, ctrl_packet);
+        if (llwrite(ctrl_packet, ctrl_len) < 0) result = -1;
         
+        free_packet_codec(&packet_codec);
         fclose(file);
-        printf("File sent successfully\n");
+        printf("%s\n", result == 0 ? "File sent successfully" : "File transfer failed");
         
     } else {
         // Receiver mode
-        unsigned char packet[MAX_PAYLOAD_SIZE];
+        unsigned char *packet = malloc(llmaxpayload());
+        if (packet == NULL) {
+            perror("malloc");
+            llclose(1);
+            return;
+        }
         
         // Receive start control packet
         int packet_len = llread(packet);
         char received_filename[256];
         long file_size;
+        int received_codec;
+        PacketCodec packet_codec;
         
         if (parse_control_packet(packet, packet_len, 
-                                received_filename, &file_size) < 0) {
+                                received_filename, &file_size, &received_codec) < 0 ||
+            init_packet_codec(&packet_codec, received_codec) < 0) {
             printf("Invalid start packet\n");
+            free(packet);
             llclose(1);
             return;
         }
@@ -270,21 +1441,27 @@ void applicationLayer(const char *serialPort, const char *role,
         printf("Receiving file: %s (%ld bytes)\n", 
                received_filename, file_size);
         
+        if (received_codec != CODEC_NONE) printf("Data packets are compressed\n");
+        
         FILE *file = fopen(filename, "wb");
         if (!file) {
             perror("Cannot create file");
+            free_packet_codec(&packet_codec);
+            free(packet);
             llclose(1);
             return;
         }
         
         // Receive file data
-        receive_file_contents(fd, file, file_size);
+        int received = receive_file_contents(fd, file, file_size, &packet_codec);
         
         // Receive end control packet
         packet_len = llread(packet);
         
+        free_packet_codec(&packet_codec);
+        free(packet);
         fclose(file);
-        printf("File received successfully\n");
+        printf("%s\n", received == 0 ? "File received successfully" : "File transfer failed");
     }
     
     llclose(1);
@@ -4,6 +4,28 @@
 #ifndef _APPLICATION_LAYER_H_
 #define _APPLICATION_LAYER_H_
 
+#include "link_layer.h"
+
+// Serial ports a single transfer can be striped across
+#define MAX_BOND_LINKS 8
+
+// Optional settings given on the command line. A zeroed struct keeps the
+// default behaviour.
+typedef struct
+{
+    LinkOptions link; // Proposed to the receiver in llopen()
+    // With link.duplex: on tx, where to save the file the receiver sends
+    // back; on rx, the file to send back while receiving
+    const char *duplexFile;
+    // On tx, compress the data packets with a streaming LZ codec announced in
+    // the START packet; chunks that do not shrink still go uncompressed
+    int compress;
+    // Further ports bonded to serialPort, listed in the same order at both
+    // ends; the file is striped across all of them
+    const char *bondPorts[MAX_BOND_LINKS - 1];
+    int bondPortCount;
+} ApplicationOptions;
+
 // Application layer main function.
 // Arguments:
 //   serialPort: Serial port name (e.g., /dev/ttyS0).
@@ -12,7 +34,9 @@
 //   nTries: Maximum number of frame retries.
 //   timeout: Frame timeout.
 //   filename: Name of the file to send / receive.
+//   options: Optional settings, may be NULL.
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
-                      int nTries, int timeout, const char *filename);
+                      int nTries, int timeout, const char *filename,
+                      const ApplicationOptions *options);
 
 #endif // _APPLICATION_LAYER_H_
@@ -0,0 +1,337 @@
+// Byte stuffing kernels.
+// The SIMD versions look for FRAME_FLAG/ESCAPE_BYTE (and, for stuffing with
+// flow control, XON/XOFF) a whole vector at a time
+// and copy the clean runs in between in bulk; they produce exactly the same
+// output as the scalar loops, which also handle the tails.
+
+#include "byte_stuffing.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+typedef int (*StuffFn)(const unsigned char *, int, unsigned char *, int);
+typedef int (*RunFn)(const unsigned char *, int, int);
+typedef int (*DestuffFn)(const unsigned char *, int, unsigned char *, int, int *, int *);
+
+////////////////////////////////////////////////
+// Scalar kernels
+////////////////////////////////////////////////
+static int needs_escape(unsigned char byte, int escape_flow) {
+    return byte == FRAME_FLAG || byte == ESCAPE_BYTE ||
+           (escape_flow && (byte == XON_BYTE || byte == XOFF_BYTE));
+}
+
+static int stuff_scalar(const unsigned char *src, int length, unsigned char *dst, int escape_flow) {
+    int out = 0;
+    
+    for (int i = 0; i < length; i++) {
+        if (needs_escape(src[i], escape_flow)) {
+            dst[out++] = ESCAPE_BYTE;
+            dst[out++] = src[i] ^ 0x20;
+        } else {
+            dst[out++] = src[i];
+        }
+    }
+    return out;
+}
+
+static int run_scalar(const unsigned char *src, int length, int escape_flow) {
+    int i = 0;
+    while (i < length && !needs_escape(src[i], escape_flow)) i++;
+    return i;
+}
+
+static int destuff_scalar(const unsigned char *src, int length, unsigned char *dst,
+                          int dst_size, int *written, int *in_escape) {
+    int i = 0;
+    int out = 0;
+    
+    for (; i < length; i++) {
+        unsigned char byte = src[i];
+        if (byte == FRAME_FLAG) break;
+        
+        if (*in_escape) {
+            if (out >= dst_size) break;
+            dst[out++] = byte ^ 0x20;
+            *in_escape = 0;
+        } else if (byte == ESCAPE_BYTE) {
+            *in_escape = 1;
+        } else {
+            if (out >= dst_size) break;
+            dst[out++] = byte;
+        }
+    }
+    
+    *written = out;
+    return i;
+}
+
+#ifdef HAVE_X86_KERNELS
+////////////////////////////////////////////////
+// SIMD kernels
+////////////////////////////////////////////////
+
+// Each vector is stored whole, then the output only advances past the clean
+// prefix; bytes after it are overwritten by what follows.
+
+// Bitmask of the FRAME_FLAG/ESCAPE_BYTE lanes in 16 bytes, plus XON/XOFF
+// with escape_flow (destuffing never needs those)
+__attribute__((target("sse2")))
+static unsigned special_mask_sse2(__m128i v, int escape_flow) {
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)FRAME_FLAG)),
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8((char)ESCAPE_BYTE)));
+    if (escape_flow) {
+        special = _mm_or_si128(special,
+                               _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)XON_BYTE)),
+                                            _mm_cmpeq_epi8(v, _mm_set1_epi8((char)XOFF_BYTE))));
+    }
+    return (unsigned)_mm_movemask_epi8(special);
+}
+
+// Same for 32 bytes
+__attribute__((target("avx2")))
+static unsigned special_mask_avx2(__m256i v, int escape_flow) {
+    __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)FRAME_FLAG)),
+                                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)ESCAPE_BYTE)));
+    if (escape_flow) {
+        special = _mm256_or_si256(special,
+                                  _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)XON_BYTE)),
+                                                  _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)XOFF_BYTE))));
+    }
+    return (unsigned)_mm256_movemask_epi8(special);
+}
+
+// dst holds 2 * length bytes and out <= 2 * i, so a full vector store at
+// dst + out never runs past the end while i + width <= length
+__attribute__((target("sse2")))
+static int stuff_sse2(const unsigned char *src, int length, unsigned char *dst, int escape_flow) {
+    int i = 0;
+    int out = 0;
+    
+    while (i + 16 <= length) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned mask = special_mask_sse2(v, escape_flow);
+        _mm_storeu_si128((__m128i *)(dst + out), v);
+        
+        if (mask == 0) {
+            i += 16;
+            out += 16;
+            continue;
+        }
+        
+        int run = __builtin_ctz(mask);
+        out += run;
+        dst[out++] = ESCAPE_BYTE;
+        dst[out++] = src[i + run] ^ 0x20;
+        i += run + 1;
+    }
+    
+    return out + stuff_scalar(src + i, length - i, dst + out, escape_flow);
+}
+
+__attribute__((target("avx2")))
+static int stuff_avx2(const unsigned char *src, int length, unsigned char *dst, int escape_flow) {
+    int i = 0;
+    int out = 0;
+    
+    while (i + 32 <= length) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        unsigned mask = special_mask_avx2(v, escape_flow);
+        _mm256_storeu_si256((__m256i *)(dst + out), v);
+        
+        if (mask == 0) {
+            i += 32;
+            out += 32;
+            continue;
+        }
+        
+        int run = __builtin_ctz(mask);
+        out += run;
+        dst[out++] = ESCAPE_BYTE;
+        dst[out++] = src[i + run] ^ 0x20;
+        i += run + 1;
+    }
+    
+    return out + stuff_scalar(src + i, length - i, dst + out, escape_flow);
+}
+
+__attribute__((target("sse2")))
+static int run_sse2(const unsigned char *src, int length, int escape_flow) {
+    int i = 0;
+    while (i + 16 <= length) {
+        unsigned mask = special_mask_sse2(_mm_loadu_si128((const __m128i *)(src + i)), escape_flow);
+        if (mask != 0) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + run_scalar(src + i, length - i, escape_flow);
+}
+
+__attribute__((target("avx2")))
+static int run_avx2(const unsigned char *src, int length, int escape_flow) {
+    int i = 0;
+    while (i + 32 <= length) {
+        unsigned mask = special_mask_avx2(_mm256_loadu_si256((const __m256i *)(src + i)), escape_flow);
+        if (mask != 0) return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    return i + run_scalar(src + i, length - i, escape_flow);
+}
+
+// Handle the special byte at src[*i] that ends a clean run. Returns 1 when
+// destuffing has to stop: on a flag (left unconsumed) or on an escape with
+// nothing usable after it (consumed and remembered in *in_escape).
+static int destuff_special(const unsigned char *src, int length, int *i,
+                           unsigned char *dst, int *out, int *in_escape) {
+    if (src[*i] == FRAME_FLAG) return 1;
+    
+    // A flag right after an escape still ends the frame
+    if (*i + 1 >= length || src[*i + 1] == FRAME_FLAG) {
+        *in_escape = 1;
+        (*i)++;
+        return 1;
+    }
+    
+    dst[(*out)++] = src[*i + 1] ^ 0x20;
+    *i += 2;
+    return 0;
+}
+
+__attribute__((target("sse2")))
+static int destuff_sse2(const unsigned char *src, int length, unsigned char *dst,
+                        int dst_size, int *written, int *in_escape) {
+    int i = 0;
+    int out = 0;
+    
+    // Finish an escape left over from the previous piece the slow way
+    if (*in_escape) {
+        i = destuff_scalar(src, length > 0 ? 1 : 0, dst, dst_size, &out, in_escape);
+        if (i == 0) {
+            *written = 0;
+            return 0;
+        }
+    }
+    
+    while (i + 16 <= length && out + 16 <= dst_size) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned mask = special_mask_sse2(v, 0);
+        _mm_storeu_si128((__m128i *)(dst + out), v);
+        
+        if (mask == 0) {
+            i += 16;
+            out += 16;
+            continue;
+        }
+        
+        int run = __builtin_ctz(mask);
+        out += run;
+        i += run;
+        if (destuff_special(src, length, &i, dst, &out, in_escape)) {
+            *written = out;
+            return i;
+        }
+    }
+    
+    int tail_written;
+    i += destuff_scalar(src + i, length - i, dst + out, dst_size - out, &tail_written, in_escape);
+    *written = out + tail_written;
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int destuff_avx2(const unsigned char *src, int length, unsigned char *dst,
+                        int dst_size, int *written, int *in_escape) {
+    int i = 0;
+    int out = 0;
+    
+    // Finish an escape left over from the previous piece the slow way
+    if (*in_escape) {
+        i = destuff_scalar(src, length > 0 ? 1 : 0, dst, dst_size, &out, in_escape);
+        if (i == 0) {
+            *written = 0;
+            return 0;
+        }
+    }
+    
+    while (i + 32 <= length && out + 32 <= dst_size) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        unsigned mask = special_mask_avx2(v, 0);
+        _mm256_storeu_si256((__m256i *)(dst + out), v);
+        
+        if (mask == 0) {
+            i += 32;
+            out += 32;
+            continue;
+        }
+        
+        int run = __builtin_ctz(mask);
+        out += run;
+        i += run;
+        if (destuff_special(src, length, &i, dst, &out, in_escape)) {
+            *written = out;
+            return i;
+        }
+    }
+    
+    int tail_written;
+    i += destuff_scalar(src + i, length - i, dst + out, dst_size - out, &tail_written, in_escape);
+    *written = out + tail_written;
+    return i;
+}
+#endif // HAVE_X86_KERNELS
+
+////////////////////////////////////////////////
+// Runtime dispatch
+////////////////////////////////////////////////
+static StuffFn stuff_impl = NULL;
+static RunFn run_impl = NULL;
+static DestuffFn destuff_impl = NULL;
+static const char *kernel_name = "scalar";
+
+// Links may run on several threads, so the kernels are picked exactly once
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void) {
+    stuff_impl = stuff_scalar;
+    run_impl = run_scalar;
+    destuff_impl = destuff_scalar;
+    
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        stuff_impl = stuff_avx2;
+        run_impl = run_avx2;
+        destuff_impl = destuff_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        stuff_impl = stuff_sse2;
+        run_impl = run_sse2;
+        destuff_impl = destuff_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+int stuff_bytes(const unsigned char *src, int length, unsigned char *dst, int escape_flow) {
+    pthread_once(&kernels_once, select_kernels);
+    return stuff_impl(src, length, dst, escape_flow);
+}
+
+int stuff_run_length(const unsigned char *src, int length, int escape_flow) {
+    pthread_once(&kernels_once, select_kernels);
+    return run_impl(src, length, escape_flow);
+}
+
+int destuff_bytes(const unsigned char *src, int length, unsigned char *dst,
+                  int dst_size, int *written, int *in_escape) {
+    pthread_once(&kernels_once, select_kernels);
+    return destuff_impl(src, length, dst, dst_size, written, in_escape);
+}
+
+const char *byte_stuffing_kernel(void) {
+    pthread_once(&kernels_once, select_kernels);
+    return kernel_name;
+}
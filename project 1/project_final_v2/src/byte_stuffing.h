@@ -0,0 +1,37 @@
+// Byte stuffing header.
+
+#ifndef _BYTE_STUFFING_H_
+#define _BYTE_STUFFING_H_
+
+// Frame delimiter and the escape byte that protects it inside a frame.
+// An escaped byte is sent as ESCAPE_BYTE followed by the byte XOR 0x20.
+#define FRAME_FLAG 0x7E
+#define ESCAPE_BYTE 0x7D
+
+// Software flow control characters. With XON/XOFF enabled the serial driver
+// swallows them, so stuffing escapes them as well when escape_flow is set.
+#define XON_BYTE 0x11
+#define XOFF_BYTE 0x13
+
+// Stuff "length" bytes from src into dst, which must have room for
+// 2 * length bytes.
+// Returns the number of bytes written to dst.
+int stuff_bytes(const unsigned char *src, int length, unsigned char *dst, int escape_flow);
+
+// Number of bytes at the start of src that go out unchanged, i.e. the index
+// of the first byte that needs escaping (length if there is none).
+int stuff_run_length(const unsigned char *src, int length, int escape_flow);
+
+// Destuff bytes from src into dst until a FRAME_FLAG is found (it is not
+// consumed), src runs out or dst_size bytes have been written.
+// An escape byte at the end of src is remembered in *in_escape so a frame can
+// be destuffed in pieces.
+// Returns the number of bytes consumed from src; *written receives the number
+// of bytes written to dst.
+int destuff_bytes(const unsigned char *src, int length, unsigned char *dst,
+                  int dst_size, int *written, int *in_escape);
+
+// Name of the kernel picked for this CPU ("avx2", "sse2" or "scalar").
+const char *byte_stuffing_kernel(void);
+
+#endif // _BYTE_STUFFING_H_
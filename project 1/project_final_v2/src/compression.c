@@ -0,0 +1,217 @@
+// Streaming LZ77 compression.
+// The format follows LZ4 sequences: a token byte with the literal count in
+// the high nibble and the match length minus 4 in the low one (15 means more
+// length bytes follow, each adding up to 255), the literals, then a 2-byte
+// little-endian match offset. A chunk may end right after its literals.
+// Matches are found greedily through a hash of the next 4 bytes, and may
+// point into earlier chunks as long as they are within the window.
+
+#include "compression.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define HASH_BITS 14
+#define HISTORY_SIZE (LZ_WINDOW_SIZE + LZ_MAX_CHUNK)
+
+struct LzStream {
+    unsigned char history[HISTORY_SIZE];
+    int used;
+    int table[1 << HASH_BITS]; // Latest history position per hash, -1 if none
+};
+
+LzStream *lz_stream_new(void) {
+    LzStream *stream = malloc(sizeof(*stream));
+    if (stream == NULL) return NULL;
+    stream->used = 0;
+    for (int i = 0; i < (1 << HASH_BITS); i++) stream->table[i] = -1;
+    return stream;
+}
+
+void lz_stream_free(LzStream *stream) {
+    free(stream);
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static int hash4(const unsigned char *p) {
+    return (int)((read32(p) * 2654435761u) >> (32 - HASH_BITS));
+}
+
+// Make room for length more bytes; only the last window is worth keeping
+static void make_room(LzStream *stream, int length) {
+    if (stream->used + length <= HISTORY_SIZE) return;
+
+    int shift = stream->used - LZ_WINDOW_SIZE;
+    memmove(stream->history, stream->history + shift, LZ_WINDOW_SIZE);
+    stream->used = LZ_WINDOW_SIZE;
+    for (int i = 0; i < (1 << HASH_BITS); i++) {
+        stream->table[i] = stream->table[i] >= shift ? stream->table[i] - shift : -1;
+    }
+}
+
+// Index history positions [from, to) that have 4 bytes after them
+static void index_positions(LzStream *stream, int from, int to) {
+    for (int pos = from; pos < to && pos + MIN_MATCH <= stream->used; pos++) {
+        stream->table[hash4(stream->history + pos)] = pos;
+    }
+}
+
+////////////////////////////////////////////////
+// Compression
+////////////////////////////////////////////////
+static int put_length(unsigned char *dst, int idx, int dst_size, int length) {
+    while (length >= 255) {
+        if (idx >= dst_size) return -1;
+        dst[idx++] = 255;
+        length -= 255;
+    }
+    if (idx >= dst_size) return -1;
+    dst[idx++] = length;
+    return idx;
+}
+
+// Append one sequence at dst[idx]; match_len 0 ends the chunk with literals.
+// Returns the new output size, or -1 once dst is full.
+static int put_sequence(unsigned char *dst, int idx, int dst_size, const unsigned char *literals,
+                        int literal_len, int offset, int match_len) {
+    if (idx >= dst_size) return -1;
+    int token = idx++;
+    int match_code = match_len > 0 ? match_len - MIN_MATCH : 0;
+    dst[token] = ((literal_len < 15 ? literal_len : 15) << 4) | (match_code < 15 ? match_code : 15);
+
+    if (literal_len >= 15 && (idx = put_length(dst, idx, dst_size, literal_len - 15)) < 0) return -1;
+    if (idx + literal_len > dst_size) return -1;
+    memcpy(dst + idx, literals, literal_len);
+    idx += literal_len;
+    if (match_len == 0) return idx;
+
+    if (idx + 2 > dst_size) return -1;
+    dst[idx++] = offset & 0xFF;
+    dst[idx++] = offset >> 8;
+    if (match_code >= 15) idx = put_length(dst, idx, dst_size, match_code - 15);
+    return idx;
+}
+
+int lz_compress(LzStream *stream, const unsigned char *src, int length,
+                unsigned char *dst, int dst_size) {
+    make_room(stream, length);
+    unsigned char *history = stream->history;
+    int start = stream->used;
+    memcpy(history + start, src, length);
+    stream->used += length;
+
+    int end = stream->used;
+    int pos = start;
+    int anchor = start; // First byte not yet emitted
+    int out = 0;
+
+    // Once dst is full the rest is only indexed, for the chunks to come
+    while (pos + MIN_MATCH <= end) {
+        int hash = hash4(history + pos);
+        int candidate = stream->table[hash];
+        stream->table[hash] = pos;
+
+        if (candidate < 0 || pos - candidate > LZ_WINDOW_SIZE ||
+            read32(history + candidate) != read32(history + pos)) {
+            pos++;
+            continue;
+        }
+
+        int match_len = MIN_MATCH;
+        while (pos + match_len < end && history[candidate + match_len] == history[pos + match_len]) {
+            match_len++;
+        }
+        if (out >= 0) {
+            out = put_sequence(dst, out, dst_size, history + anchor, pos - anchor,
+                               pos - candidate, match_len);
+        }
+        index_positions(stream, pos + 1, pos + match_len);
+        pos += match_len;
+        anchor = pos;
+    }
+
+    if (anchor < end && out >= 0) {
+        out = put_sequence(dst, out, dst_size, history + anchor, end - anchor, 0, 0);
+    }
+    return out;
+}
+
+void lz_append(LzStream *stream, const unsigned char *src, int length) {
+    make_room(stream, length);
+    int start = stream->used;
+    memcpy(stream->history + start, src, length);
+    stream->used += length;
+    index_positions(stream, start > MIN_MATCH ? start - MIN_MATCH : 0, stream->used);
+}
+
+////////////////////////////////////////////////
+// Decompression
+////////////////////////////////////////////////
+static int get_length(const unsigned char *src, int *idx, int length) {
+    int total = 0;
+    unsigned char byte;
+    do {
+        if (*idx >= length) return -1;
+        byte = src[(*idx)++];
+        total += byte;
+    } while (byte == 255);
+    return total;
+}
+
+int lz_decompress(LzStream *stream, const unsigned char *src, int length,
+                  unsigned char *dst, int dst_size) {
+    if (dst_size > LZ_MAX_CHUNK) dst_size = LZ_MAX_CHUNK;
+
+    // The chunk is rebuilt at the end of the history, where matches can reach it
+    make_room(stream, dst_size);
+    unsigned char *out = stream->history + stream->used;
+    int produced = 0;
+    int idx = 0;
+
+    while (idx < length) {
+        int token = src[idx++];
+
+        int literal_len = token >> 4;
+        if (literal_len == 15) {
+            int extra = get_length(src, &idx, length);
+            if (extra < 0) return -1;
+            literal_len += extra;
+        }
+        if (idx + literal_len > length || produced + literal_len > dst_size) return -1;
+        memcpy(out + produced, src + idx, literal_len);
+        produced += literal_len;
+        idx += literal_len;
+        if (idx == length) break;
+
+        if (idx + 2 > length) return -1;
+        int offset = src[idx] | (src[idx + 1] << 8);
+        idx += 2;
+        int match_len = (token & 0x0F) + MIN_MATCH;
+        if ((token & 0x0F) == 15) {
+            int extra = get_length(src, &idx, length);
+            if (extra < 0) return -1;
+            match_len += extra;
+        }
+        if (offset == 0 || offset > stream->used + produced || produced + match_len > dst_size) {
+            return -1;
+        }
+
+        // Byte by byte: the match may overlap what it is producing
+        const unsigned char *from = out + produced - offset;
+        for (int i = 0; i < match_len; i++) {
+            out[produced + i] = from[i];
+        }
+        produced += match_len;
+    }
+
+    stream->used += produced;
+    memcpy(dst, out, produced);
+    return produced;
+}
@@ -0,0 +1,34 @@
+// Streaming LZ77 compression header.
+
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+// Matches reach back up to LZ_WINDOW_SIZE bytes into everything the stream
+// has seen, earlier chunks included. A chunk holds at most LZ_MAX_CHUNK bytes.
+#define LZ_WINDOW_SIZE 65535
+#define LZ_MAX_CHUNK 65536
+
+typedef struct LzStream LzStream;
+
+// New stream with an empty history, or NULL if out of memory. Each end of a
+// transfer keeps its own, fed with the same chunks in the same order.
+LzStream *lz_stream_new(void);
+void lz_stream_free(LzStream *stream);
+
+// Compress a chunk into dst.
+// Returns the compressed size, or -1 if it does not fit in dst_size bytes.
+// Either way the chunk joins the history, so when it does not fit it must be
+// sent as is and passed to lz_append() at the other end.
+int lz_compress(LzStream *stream, const unsigned char *src, int length,
+                unsigned char *dst, int dst_size);
+
+// Decompress a chunk into dst.
+// Returns its size, or -1 if the input is corrupt or does not fit in
+// dst_size bytes.
+int lz_decompress(LzStream *stream, const unsigned char *src, int length,
+                  unsigned char *dst, int dst_size);
+
+// Add a chunk that was sent uncompressed to the history.
+void lz_append(LzStream *stream, const unsigned char *src, int length);
+
+#endif // _COMPRESSION_H_
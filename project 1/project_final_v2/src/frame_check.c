@@ -0,0 +1,176 @@
+// Frame check sequence kernels.
+// Both CRCs are reflected, so one slice-by-8 routine serves them: eight
+// table lookups fold eight input bytes per step. CRC-32C uses the SSE4.2
+// crc32 instruction instead when the CPU has it.
+
+#include "frame_check.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_CRC32 1
+#endif
+
+#define CRC16_POLY_REFLECTED 0x8408
+#define CRC32C_POLY_REFLECTED 0x82F63B78
+
+typedef struct {
+    uint32_t table[8][256];
+} CrcTables;
+
+static CrcTables crc16_tables;
+static CrcTables crc32c_tables;
+
+////////////////////////////////////////////////
+// Slice-by-8
+////////////////////////////////////////////////
+
+// table[0] is the classic byte-at-a-time table; table[k] advances a byte's
+// contribution by k further bytes of zeros
+static void build_tables(CrcTables *tables, uint32_t poly) {
+    for (int n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+        }
+        tables->table[0][n] = crc;
+    }
+    
+    for (int n = 0; n < 256; n++) {
+        uint32_t crc = tables->table[0][n];
+        for (int k = 1; k < 8; k++) {
+            crc = (crc >> 8) ^ tables->table[0][crc & 0xFF];
+            tables->table[k][n] = crc;
+        }
+    }
+}
+
+static uint32_t load_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc_slice8(const CrcTables *tables, uint32_t crc,
+                           const unsigned char *data, int length) {
+    const uint32_t (*t)[256] = tables->table;
+    
+    while (length >= 8) {
+        uint32_t one = load_le32(data) ^ crc;
+        uint32_t two = load_le32(data + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+              t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        data += 8;
+        length -= 8;
+    }
+    
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef HAVE_X86_CRC32
+////////////////////////////////////////////////
+// SSE4.2
+////////////////////////////////////////////////
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, int length) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word = (uint64_t)load_le32(data) | ((uint64_t)load_le32(data + 4) << 32);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (length >= 4) {
+        crc = _mm_crc32_u32(crc, load_le32(data));
+        data += 4;
+        length -= 4;
+    }
+    while (length-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif // HAVE_X86_CRC32
+
+////////////////////////////////////////////////
+// CRCs
+////////////////////////////////////////////////
+static int use_sse42;
+
+// Links may run on several threads, so the tables are built exactly once
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void init_crc(void) {
+    build_tables(&crc16_tables, CRC16_POLY_REFLECTED);
+    build_tables(&crc32c_tables, CRC32C_POLY_REFLECTED);
+#ifdef HAVE_X86_CRC32
+    __builtin_cpu_init();
+    use_sse42 = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#endif
+}
+
+static int crc32c_has_sse42(void) {
+    pthread_once(&crc_once, init_crc);
+    return use_sse42;
+}
+
+uint16_t crc16_ccitt(const unsigned char *data, int length) {
+    pthread_once(&crc_once, init_crc);
+    return (uint16_t)(crc_slice8(&crc16_tables, 0xFFFF, data, length) ^ 0xFFFF);
+}
+
+uint32_t crc32c(const unsigned char *data, int length) {
+#ifdef HAVE_X86_CRC32
+    if (crc32c_has_sse42()) return crc32c_sse42(0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
+#endif
+    return crc_slice8(&crc32c_tables, 0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
+}
+
+const char *crc32c_kernel(void) {
+    return crc32c_has_sse42() ? "sse4.2" : "slice-by-8";
+}
+
+////////////////////////////////////////////////
+// Frame check sequence
+////////////////////////////////////////////////
+int fcs_size(LinkFcsMode mode) {
+    switch (mode) {
+        case LlFcsCrc16: return 2;
+        case LlFcsCrc32c: return 4;
+        default: return 1;
+    }
+}
+
+int fcs_compute(LinkFcsMode mode, const unsigned char *data, int length, unsigned char *fcs) {
+    switch (mode) {
+        case LlFcsCrc16: {
+            uint16_t crc = crc16_ccitt(data, length);
+            fcs[0] = crc & 0xFF;
+            fcs[1] = crc >> 8;
+            return 2;
+        }
+        case LlFcsCrc32c: {
+            uint32_t crc = crc32c(data, length);
+            for (int i = 0; i < 4; i++) {
+                fcs[i] = (crc >> (8 * i)) & 0xFF;
+            }
+            return 4;
+        }
+        default: {
+            // Legacy BCC2: XOR of all data bytes
+            unsigned char bcc = 0;
+            for (int i = 0; i < length; i++) {
+                bcc ^= data[i];
+            }
+            fcs[0] = bcc;
+            return 1;
+        }
+    }
+}
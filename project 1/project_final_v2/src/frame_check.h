@@ -0,0 +1,29 @@
+// Frame check sequence header.
+
+#ifndef _FRAME_CHECK_H_
+#define _FRAME_CHECK_H_
+
+#include "link_layer.h"
+#include <stdint.h>
+
+// Largest frame check sequence, in bytes.
+#define MAX_FCS_SIZE 4
+
+// Size in bytes of the frame check sequence of the given mode.
+int fcs_size(LinkFcsMode mode);
+
+// Compute the frame check sequence of data into fcs, least significant
+// byte first (as HDLC sends it).
+// Returns the number of bytes written to fcs.
+int fcs_compute(LinkFcsMode mode, const unsigned char *data, int length, unsigned char *fcs);
+
+// CRC-16-CCITT as used by HDLC/X.25 (reflected 0x1021, init and final XOR 0xFFFF).
+uint16_t crc16_ccitt(const unsigned char *data, int length);
+
+// CRC-32C, Castagnoli (reflected 0x1EDC6F41, init and final XOR 0xFFFFFFFF).
+uint32_t crc32c(const unsigned char *data, int length);
+
+// Name of the CRC-32C kernel picked for this CPU ("sse4.2" or "slice-by-8").
+const char *crc32c_kernel(void);
+
+#endif // _FRAME_CHECK_H_
@@ -1,20 +1,29 @@
 #include "link_layer.h"
+#include "byte_stuffing.h"
+#include "frame_check.h"
+#include "reed_solomon.h"
 #include "serial_port.h"
+#include "serial_speed.h"
+#include "trace.h"
 #include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
-#include <signal.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <errno.h>
 
-// Frame delimiters and control bytes
-#define FRAME_FLAG 0x7E
-#define ESCAPE_BYTE 0x7D
+// Frame addresses and control bytes (delimiters are in byte_stuffing.h)
 #define ADDR_SENDER 0x03
 #define ADDR_RECEIVER 0x01
 #define CTRL_SET 0x03
@@ -24,49 +33,222 @@
 #define CTRL_REJ(n) ((n) ? 0x81 : 0x01)
 #define CTRL_INFO(n) ((n) ? 0x40 : 0x00)
 
-// Connection state
+// Windowed modes carry a modulo-16 sequence number in the high nibble of the
+// control byte; the low nibble still tells the frame type apart
+#define SEQ_MODULUS 16
+#define CTRL_INFO_N(n) ((unsigned char)((n) << 4))
+#define CTRL_RR_N(n) ((unsigned char)(((n) << 4) | 0x05))
+#define CTRL_REJ_N(n) ((unsigned char)(((n) << 4) | 0x01))
+#define CTRL_SREJ_N(n) ((unsigned char)(((n) << 4) | 0x0D))
+#define CTRL_TYPE(c) ((c) & 0x0F)
+#define CTRL_TYPE_INFO 0x00
+#define CTRL_TYPE_RR 0x05
+#define CTRL_TYPE_REJ 0x01
+#define CTRL_TYPE_SREJ 0x0D
+
+// Link parameters carried as TLVs in the information field of SET/UA
+#define PARAM_ARQ_MODE 0
+#define PARAM_WINDOW_SIZE 1
+#define PARAM_FCS_MODE 2
+#define PARAM_MAX_PAYLOAD 3
+#define PARAM_DUPLEX 4
+#define PARAM_FEC_ERRORS 5
+#define PARAM_BAUD_RATE 6
+#define MAX_PARAMS_SIZE 32
+
+// Opening flag and the header fields (address, control, piggybacked RR,
+// BCC1), all of them escaped at worst
+#define MAX_HEADER_SIZE 9
+
+// Most iovecs one writev() takes (IOV_MAX on Linux)
+#define MAX_IOV_BATCH 1024
+
+// Bounds for the adaptive retransmission timeout
+#define MIN_RTO_MS 100
+#define MAX_RTO_MS 60000
+
+// Silence after which a receiver at a negotiated baud rate returns to the
+// opening one; the transmitter waits as long before resending there
+#define BAUD_FALLBACK_MS 5000
+
+// Errors among the last 32 frames sent at a negotiated rate (each new frame
+// counts as one event, each timeout, REJ or SREJ as another) that send the
+// link back to the opening rate
+#define BAUD_ERROR_LIMIT 8
+
+// Result of feeding bytes to the frame parser
+typedef enum {
+    FRAME_NONE,        // No complete frame yet
+    FRAME_SUPERVISION, // Header-only frame (SET, UA, DISC, RR, REJ, SREJ)
+    FRAME_INFO,        // Frame with a data field that passed BCC2
+    FRAME_BAD_DATA,    // Frame with a data field that failed BCC2
+} FrameEvent;
+
+// Incremental frame parser; keeps partial frames across calls
+typedef struct {
+    enum { WAIT_FLAG, READ_ADDR, READ_CTRL, READ_ACK, READ_BCC1, READ_DATA } state;
+    unsigned char addr;
+    unsigned char ctrl;
+    unsigned char ack; // RR carried by a duplex I-frame, 0 otherwise
+    int in_escape;
+    int length;
+    unsigned char *data; // Destuffed data field plus BCC2
+    int capacity;
+} FrameParser;
+
+// Bytes read from the port but not yet parsed
+#define RX_RING_SIZE 4096
+typedef struct {
+    unsigned char data[RX_RING_SIZE];
+    int head;  // Next byte to parse
+    int count; // Bytes waiting
+} RxRing;
+
+// Transmitted I-frame kept until acknowledged. The data field is kept as
+// is; iov lays out the frame on the wire for writev(): the header, the clean
+// runs of the field with escape pairs in between, and the end flag.
+typedef struct {
+    unsigned char header[MAX_HEADER_SIZE];
+    unsigned char ctrl;
+    unsigned char *field;
+    struct iovec *iov;
+    int iov_count;
+    int iov_capacity;
+    int size;          // Bytes on the wire
+    int stuffing;      // Escape bytes stuffing added to the field
+    int retries;
+    int transmissions;
+    long departed_us; // When the last byte of the latest transmission left the port
+} WindowSlot;
+
+// I-frame accepted in order and acknowledged, waiting for llread()
+#define INBOX_SIZE (MAX_WINDOW_SIZE * 2)
+typedef struct {
+    unsigned char *data;
+    int length;
+} InboxSlot;
+
+// Out-of-order I-frame held by the Selective Repeat receiver
 typedef struct {
+    unsigned char *data;
+    int length;
+    int valid;
+    int srej_sent;
+} ReorderSlot;
+
+// State of one link; every port opened gets its own
+struct LinkSession {
+    char serial_port[50];
     int fd;
+    struct termios saved_tio; // Port settings restored on close
     LinkLayerRole role;
-    int timeout_duration;
+    int baud_rate;
+    int base_baud_rate; // Rate the port was opened at, to fall back to
+    long last_valid_us; // Last frame that passed its checks
+    uint32_t baud_errors; // Last 32 events at a negotiated rate, set bits for errors
+    int timeout_ms;    // Initial retransmission timeout, until the RTT is measured
+    int rto_ms;        // Current retransmission timeout
+    long srtt_us;      // Smoothed round-trip time
+    long rttvar_us;    // Round-trip time variation
+    int rtt_samples;
     int max_retries;
-    int current_sequence;
-    volatile int alarm_triggered;
+    int timer_fd;      // Retransmission timer, polled with the serial port
+    int timer_expired;
+    long line_free_us; // When the port will have sent everything written so far
     int retry_count;
-} ConnectionState;
-
-static ConnectionState conn_state = {-1, LlTx, 3, 3, 0, 0, 0};
+    LinkArqMode arq_mode;
+    int window_size;
+    int seq_modulus;
+    LinkFcsMode fcs_mode;
+    int max_payload;
+    int duplex;        // Both sides send I-frames, acknowledgements ride on them
+    int escape_flow;   // XON/XOFF flow control: those bytes are escaped, headers included
+    int fec_errors;    // Byte errors the FEC repairs per block, 0 without FEC
+    unsigned char *fec_plain; // Payload and frame check of the I-frame being encoded
+    // Transmitter: frames [seq_base, seq_end) are unacknowledged,
+    // seq_next is the next one to put on the wire
+    int seq_base;
+    int seq_next;
+    int seq_end;
+    int link_failed;
+    long frames_acked;   // I-frames acknowledged, and how many llpoll() reported
+    long acked_reported;
+    int frames_sent;
+    int retransmissions;
+    int rejects;
+    int timeouts;
+    long bytes_sent;
+    long wire_bytes_sent;
+    long stuffing_bytes;
+    // Receiver
+    int frames_received;
+    long bytes_received;
+    long wire_bytes_received;
+    int rejects_sent;
+    int duplicates;
+    int bcc1_errors;
+    int bcc2_errors;
+    int fec_repaired;
+    int seq_expected;
+    int rej_sent;
+    int ack_pending;   // An RR is owed and waits for an outgoing I-frame
+    int inbox_head;
+    int inbox_count;
+    int disc_received;
+    long opened_us;
+    int trace_id;
+    const char *stats_json; // Where llclose() appends the statistics, or NULL
+    const char *stats_csv;
+    unsigned char ua_frame[MAX_PARAMS_SIZE * 2 + 10];
+    int ua_size;
+    int ua_extended;   // The UA carries link parameters
+    FrameParser parser;
+    RxRing rx_ring;
+    WindowSlot tx_window[MAX_WINDOW_SIZE];
+    ReorderSlot rx_window[MAX_WINDOW_SIZE];
+    InboxSlot inbox[INBOX_SIZE];
+};
 
 // Forward declarations
-static int transmit_supervision_frame(int fd, unsigned char addr, unsigned char ctrl);
-static int receive_supervision_frame(int fd, unsigned char expected_ctrl);
-static int build_information_frame(const unsigned char *data, int length, unsigned char *frame);
-static unsigned char calculate_bcc(const unsigned char *data, int length);
-static void alarm_handler(int signal);
-static int setup_connection_transmitter(int fd);
-static int setup_connection_receiver(int fd);
+static int transmit_supervision_frame(LinkSession *conn, unsigned char addr, unsigned char ctrl);
+static int receive_supervision_frame(LinkSession *conn, unsigned char expected_ctrl);
+static int build_supervision_frame(LinkSession *conn, unsigned char addr, unsigned char ctrl,
+                                   unsigned char *frame);
+static int build_information_frame(LinkSession *conn, unsigned char addr, unsigned char ctrl,
+                                   const unsigned char *data, int length, unsigned char *frame);
+static int setup_connection_transmitter(LinkSession *conn, const LinkOptions *options);
+static int setup_connection_receiver(LinkSession *conn, const LinkOptions *options);
+static void build_ua_frame(LinkSession *conn, int max_baud_rate);
 
 ////////////////////////////////////////////////
 // Safe I/O helpers (add after includes)
 ////////////////////////////////////////////////
 
 /**
- * write_all - write all bytes or fail (with retry on transient errors)
+ * writev_all - write all bytes gathered from iov or fail (with retry on
+ * transient errors). Carries on after partial writes and past MAX_IOV_BATCH entries.
  * Returns: number of bytes written, or -1 on fatal error
  */
-static ssize_t write_all(int fd, const unsigned char *buf, size_t count) {
+static ssize_t writev_all(int fd, const struct iovec *iov, int count) {
+    struct iovec batch[MAX_IOV_BATCH];
     size_t written = 0;
+    size_t skip = 0;       // Bytes of iov[0] already written
     int retry_limit = 50;  // Increased: allow ~10 seconds of retries
     int retry_count = 0;
     
-    while (written < count) {
-        ssize_t n = write(fd, buf + written, count - written);
+    while (count > 0) {
+        int batch_count = count < MAX_IOV_BATCH ? count : MAX_IOV_BATCH;
+        memcpy(batch, iov, batch_count * sizeof(*iov));
+        batch[0].iov_base = (unsigned char *)batch[0].iov_base + skip;
+        batch[0].iov_len -= skip;
+        
+        ssize_t n = writev(fd, batch, batch_count);
         if (n < 0) {
             // Handle transient errors (retry)
             if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == EIO) {
                 retry_count++;
                 if (retry_count >= retry_limit) {
-                    fprintf(stderr, "write_all: channel still down after %d retries\n", retry_count);
+                    fprintf(stderr, "writev: channel still down after %d retries\n", retry_count);
                     return -1;
                 }
                 
@@ -76,553 +258,1827 @@ static ssize_t write_all(int fd, const unsigned char *buf, size_t count) {
             }
             
             // Fatal error (bad FD, etc.)
-            perror("write_all");
+            perror("writev");
             return -1;
         }
         if (n == 0) {
-            // write returned 0 - unusual, but try again
+            // writev returned 0 - unusual, but try again
             usleep(200000);
             retry_count++;
             if (retry_count >= retry_limit) {
-                fprintf(stderr, "write_all: no progress after %d attempts\n", retry_count);
+                fprintf(stderr, "writev: no progress after %d attempts\n", retry_count);
                 return written;  // Return partial write
             }
             continue;
         }
         
-        // Success - reset retry counter
+        // Success - reset retry counter and step over what went out
         written += n;
         retry_count = 0;
+        size_t done = skip + n;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        skip = done;
     }
     return (ssize_t)written;
 }
 
 /**
- * read_bytes - read exactly n bytes with timeout
- * Returns: bytes read (< n if timeout), or -1 on error
- * MUST check alarm_triggered to respect alarm(3) timeout
+ * write_all - write all bytes or fail (with retry on transient errors)
+ * Returns: number of bytes written, or -1 on fatal error
  */
-static ssize_t read_bytes(int fd, unsigned char *buf, size_t count, int timeout_sec) {
-    size_t total_read = 0;
-    time_t start = time(NULL);
-    int retry_count = 0;
-    int retry_limit = timeout_sec * 20;  // 20 retries per second
+static ssize_t write_all(int fd, const unsigned char *buf, size_t count) {
+    struct iovec iov = {.iov_base = (void *)buf, .iov_len = count};
+    return writev_all(fd, &iov, 1);
+}
+
+////////////////////////////////////////////////
+// Retransmission timer
+////////////////////////////////////////////////
+
+// A timerfd polled next to the serial port: an expiry just ends the wait,
+// there is no signal handler and no interrupted read()
+static void arm_timer(LinkSession *conn, int timeout_ms) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = timeout_ms / 1000;
+    spec.it_value.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
     
-    while (total_read < count) {
-        // CRITICAL: Check if alarm fired (respects alarm(3) call from llwrite)
-        if (conn_state.alarm_triggered) {
-            break;  // Timeout from alarm handler
-        }
-        
-        // Double-check with time-based timeout as backup
-        if (difftime(time(NULL), start) > timeout_sec) {
-            break;
-        }
-        
-        ssize_t n = read(fd, buf + total_read, count - total_read);
-        if (n < 0) {
-            // Handle transient errors
-            if (errno == EINTR) {
-                // Signal interrupted (likely our alarm) - check alarm_triggered
-                if (conn_state.alarm_triggered) break;
-                continue;
-            }
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EIO) {
-                retry_count++;
-                if (retry_count >= retry_limit) {
-                    break;
-                }
-                usleep(50000);  // 50ms backoff
-                continue;
-            }
-            
-            // Fatal error
-            perror("read_bytes");
-            return -1;
-        }
-        if (n == 0) {
-            // No data yet - check alarm before continuing
-            if (conn_state.alarm_triggered) break;
-            
-            retry_count++;
-            if (retry_count >= retry_limit) {
-                break;
-            }
-            usleep(50000);
-            continue;
+    conn->timer_expired = FALSE;
+    timerfd_settime(conn->timer_fd, 0, &spec, NULL);
+}
+
+static void disarm_timer(LinkSession *conn) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    
+    conn->timer_expired = FALSE;
+    timerfd_settime(conn->timer_fd, 0, &spec, NULL);
+}
+
+// Wait up to timeout_ms (-1 forever, 0 to only check) for the timer and,
+// if watch_port is set, the serial port. Records a timer expiry in
+// timer_expired. Returns TRUE when the port is ready to be read.
+static int wait_for_input(LinkSession *conn, int watch_port, int timeout_ms) {
+    struct pollfd pfds[2] = {
+        {.fd = conn->timer_fd, .events = POLLIN},
+        {.fd = watch_port ? conn->fd : -1, .events = POLLIN},
+    };
+    
+    if (poll(pfds, 2, timeout_ms) <= 0) return FALSE;
+    
+    if (pfds[0].revents & POLLIN) {
+        uint64_t expirations;
+        if (read(conn->timer_fd, &expirations, sizeof(expirations)) > 0) {
+            conn->timer_expired = TRUE;
         }
-        
-        // Success
-        total_read += n;
-        retry_count = 0;
     }
-    return (ssize_t)total_read;
+    return (pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
 }
 
 ////////////////////////////////////////////////
-// Alarm handling
+// Round-trip time estimation
 ////////////////////////////////////////////////
-static void alarm_handler(int signal) {
-    (void)signal;
-    conn_state.alarm_triggered = 1;
-    printf("ALARM: Timeout triggered!\n");
-    fflush(stdout); 
+static long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// Jacobson/Karels: RTO = SRTT + 4 * RTTVAR. A fresh sample also undoes any backoff.
+static void update_rtt(LinkSession *conn, long sample_us) {
+    if (conn->rtt_samples == 0) {
+        conn->srtt_us = sample_us;
+        conn->rttvar_us = sample_us / 2;
+    } else {
+        long delta = labs(conn->srtt_us - sample_us);
+        conn->rttvar_us = (3 * conn->rttvar_us + delta) / 4;
+        conn->srtt_us = (7 * conn->srtt_us + sample_us) / 8;
+    }
+    conn->rtt_samples++;
+    
+    long rto_ms = (conn->srtt_us + 4 * conn->rttvar_us) / 1000;
+    if (rto_ms < MIN_RTO_MS) rto_ms = MIN_RTO_MS;
+    if (rto_ms > MAX_RTO_MS) rto_ms = MAX_RTO_MS;
+    conn->rto_ms = (int)rto_ms;
 }
 
-static void configure_alarm_handler() {
-    struct sigaction sa;
-    sa.sa_handler = alarm_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGALRM, &sa, NULL);
+// Double the timeout after a loss
+static void back_off_rto(LinkSession *conn) {
+    conn->rto_ms = conn->rto_ms * 2 > MAX_RTO_MS ? MAX_RTO_MS : conn->rto_ms * 2;
 }
 
 ////////////////////////////////////////////////
-// BCC calculation
+// Output queue
 ////////////////////////////////////////////////
-static unsigned char calculate_bcc(const unsigned char *data, int length) {
-    unsigned char bcc = 0;
-    for (int i = 0; i < length; i++) {
-        bcc ^= data[i];
+// A write() returns once the frame is in the driver's output queue; at low
+// baud rates it leaves the port long after. Timers and RTT samples count
+// from when the last byte is out, so the RTO only has to cover the reply.
+
+// Time the port needs to shift out size bytes (8N1, so 10 bits per byte)
+static long transmission_us(LinkSession *conn, long size) {
+    return size * 10 * 1000000L / conn->baud_rate;
+}
+
+// Account for size bytes just written: they go out after whatever is queued
+static void note_written(LinkSession *conn, long size) {
+    long now = now_us();
+    long start = conn->line_free_us > now ? conn->line_free_us : now;
+    conn->line_free_us = start + transmission_us(conn, size);
+}
+
+// When everything written so far will have left the port. The count above
+// is the earliest that can be; the driver's queue (TIOCOUTQ) shows when
+// flow control or a slower line holds bytes for longer. Ptys report an
+// empty queue, which leaves the count as it is.
+static long departure_us(LinkSession *conn) {
+    int queued;
+    if (ioctl(conn->fd, TIOCOUTQ, &queued) == 0 && queued > 0) {
+        long reported = now_us() + transmission_us(conn, queued);
+        if (reported > conn->line_free_us) conn->line_free_us = reported;
     }
-    return bcc;
+    return conn->line_free_us;
+}
+
+// Timer for timeout_ms once the port is done with departed_us
+static void arm_timer_after(LinkSession *conn, long departed_us, int timeout_ms) {
+    long wait_us = departed_us - now_us();
+    arm_timer(conn, timeout_ms + (wait_us > 0 ? (int)((wait_us + 999) / 1000) : 0));
+}
+
+// Timer for a reply to everything written so far
+static void arm_reply_timer(LinkSession *conn, int timeout_ms) {
+    arm_timer_after(conn, departure_us(conn), timeout_ms);
 }
 
 ////////////////////////////////////////////////
-// Frame transmission
+// Baud rate negotiation
 ////////////////////////////////////////////////
-static int transmit_supervision_frame(int fd, unsigned char addr, unsigned char ctrl) {
-    unsigned char frame[5];
-    frame[0] = FRAME_FLAG;
-    frame[1] = addr;
-    frame[2] = ctrl;
-    frame[3] = addr ^ ctrl;
-    frame[4] = FRAME_FLAG;
+// Both sides open at the rate they were given, which is known to work, and
+// SET/UA agree on the fastest rate both support. The receiver switches once
+// its UA is out, the transmitter confirms with a SET at the new rate. If the
+// link breaks down there, both return to the opening rate for good: the
+// transmitter when a frame runs out of retries, the receiver when nothing
+// valid has arrived for BAUD_FALLBACK_MS. Should the UA offering the rate be
+// lost, the transmitter's SETs no longer reach the receiver either, so it
+// waits out the same BAUD_FALLBACK_MS and asks again without the offer.
+
+// Move the port to baud_rate once whatever was written has left at the old one
+static int switch_baud_rate(LinkSession *conn, int baud_rate) {
+    tcdrain(conn->fd);
+    if (setSerialPortBaudRateFd(conn->fd, baud_rate) < 0) return -1;
     
-    ssize_t result = write_all(fd, frame, 5);
-    return result == 5 ? 0 : -1;
+    conn->baud_rate = baud_rate;
+    conn->line_free_us = now_us();
+    conn->last_valid_us = conn->line_free_us;
+    conn->baud_errors = 0;
+    trace_event(conn->trace_id, TRACE_BAUD_RATE, 0, baud_rate);
+    printf("Switched to %d baud\n", baud_rate);
+    return 0;
 }
 
-static int build_information_frame(const unsigned char *data, int length, unsigned char *frame) {
-    int frame_idx = 0;
-    
-    // Start flag
-    frame[frame_idx++] = FRAME_FLAG;
-    frame[frame_idx++] = ADDR_SENDER;
-    frame[frame_idx++] = CTRL_INFO(conn_state.current_sequence);
-    frame[frame_idx++] = ADDR_SENDER ^ CTRL_INFO(conn_state.current_sequence);
-    
-    // Calculate BCC2
-    unsigned char bcc2 = calculate_bcc(data, length);
-    
-    // Stuff data and BCC2
-    for (int i = 0; i < length; i++) {
-        if (data[i] == FRAME_FLAG || data[i] == ESCAPE_BYTE) {
-            frame[frame_idx++] = ESCAPE_BYTE;
-            frame[frame_idx++] = data[i] ^ 0x20;
-        } else {
-            frame[frame_idx++] = data[i];
-        }
-    }
-    
-    // Stuff BCC2
-    if (bcc2 == FRAME_FLAG || bcc2 == ESCAPE_BYTE) {
-        frame[frame_idx++] = ESCAPE_BYTE;
-        frame[frame_idx++] = bcc2 ^ 0x20;
-    } else {
-        frame[frame_idx++] = bcc2;
-    }
-    
-    // End flag
-    frame[frame_idx++] = FRAME_FLAG;
+static void fall_back_baud_rate(LinkSession *conn) {
+    printf("Falling back to %d baud\n", conn->base_baud_rate);
+    // Stuck at the faster rate: at least stop trying
+    if (switch_baud_rate(conn, conn->base_baud_rate) < 0) conn->base_baud_rate = conn->baud_rate;
+    // A SET repeated from now on must not be told to switch again
+    if (conn->ua_size > 0) build_ua_frame(conn, 0);
+}
+
+// Record a frame sent (error FALSE) or an error (TRUE) at a negotiated
+// rate. Returns TRUE once errors make up too much of the last 32 events.
+static int note_baud_event(LinkSession *conn, int error) {
+    if (conn->baud_rate == conn->base_baud_rate) return FALSE;
+    conn->baud_errors = (conn->baud_errors << 1) | (error ? 1 : 0);
+    return __builtin_popcount(conn->baud_errors) >= BAUD_ERROR_LIMIT;
+}
+
+// Receiver watchdog at a negotiated rate. Returns how long input may be
+// waited for before checking again, or -1 for as long as it takes.
+static int baud_watchdog_ms(LinkSession *conn) {
+    if (conn->role != LlRx || conn->baud_rate == conn->base_baud_rate) return -1;
     
-    return frame_idx;
+    long left_us = conn->last_valid_us + BAUD_FALLBACK_MS * 1000L - now_us();
+    if (left_us > 0) return (int)((left_us + 999) / 1000);
+    printf("Nothing valid received for %d ms at %d baud\n", BAUD_FALLBACK_MS, conn->baud_rate);
+    fall_back_baud_rate(conn);
+    return -1;
 }
 
 ////////////////////////////////////////////////
-// Frame reception
+// BCC2 (frame check sequence)
 ////////////////////////////////////////////////
-static int receive_supervision_frame(int fd, unsigned char expected_ctrl) {
-    unsigned char byte;
-    enum { WAIT_FLAG, WAIT_ADDR, WAIT_CTRL, WAIT_BCC, WAIT_END } state = WAIT_FLAG;
-    unsigned char addr, ctrl;
-    
-    while (!conn_state.alarm_triggered) {
-        if (read(fd, &byte, 1) != 1) continue;
-        
-        switch (state) {
-            case WAIT_FLAG:
-                if (byte == FRAME_FLAG) state = WAIT_ADDR;
-                break;
-            case WAIT_ADDR:
-                if (byte == FRAME_FLAG) break;
-                addr = byte;
-                state = WAIT_CTRL;
-                break;
-            case WAIT_CTRL:
-                if (byte == FRAME_FLAG) { state = WAIT_ADDR; break; }
-                ctrl = byte;
-                state = WAIT_BCC;
-                break;
-            case WAIT_BCC:
-                if (byte == FRAME_FLAG) { state = WAIT_ADDR; break; }
-                if (byte == (addr ^ ctrl)) state = WAIT_END;
-                else state = WAIT_FLAG;
-                break;
-            case WAIT_END:
-                if (byte == FRAME_FLAG && ctrl == expected_ctrl) return 0;
-                state = (byte == FRAME_FLAG) ? WAIT_ADDR : WAIT_FLAG;
-                break;
+
+// SET and UA carry the negotiation itself, so they always keep the XOR BCC2
+static LinkFcsMode frame_fcs_mode(LinkSession *conn, unsigned char ctrl) {
+    return (ctrl == CTRL_SET || ctrl == CTRL_UA) ? LlFcsXor : conn->fcs_mode;
+}
+
+////////////////////////////////////////////////
+// Sequence numbers
+////////////////////////////////////////////////
+static int seq_add(LinkSession *conn, int seq, int n) {
+    return (seq + n) % conn->seq_modulus;
+}
+
+// Number of steps from "from" forward to "to"
+static int seq_distance(LinkSession *conn, int from, int to) {
+    return (to - from + conn->seq_modulus) % conn->seq_modulus;
+}
+
+// Stop-and-wait keeps the original one-bit encoding on the wire
+static unsigned char info_ctrl(LinkSession *conn, int seq) {
+    return conn->seq_modulus == 2 ? CTRL_INFO(seq) : CTRL_INFO_N(seq);
+}
+
+static unsigned char rr_ctrl(LinkSession *conn, int seq) {
+    return conn->seq_modulus == 2 ? CTRL_RR(seq) : CTRL_RR_N(seq);
+}
+
+static unsigned char rej_ctrl(LinkSession *conn, int seq) {
+    return conn->seq_modulus == 2 ? CTRL_REJ(seq) : CTRL_REJ_N(seq);
+}
+
+static int info_seq(LinkSession *conn, unsigned char ctrl) {
+    return conn->seq_modulus == 2 ? (ctrl >> 6) & 1 : ctrl >> 4;
+}
+
+static int ack_seq(LinkSession *conn, unsigned char ctrl) {
+    return conn->seq_modulus == 2 ? ctrl >> 7 : ctrl >> 4;
+}
+
+////////////////////////////////////////////////
+// Link parameter negotiation
+////////////////////////////////////////////////
+static int encode_link_params(const LinkOptions *options, unsigned char *params) {
+    int idx = 0;
+    params[idx++] = PARAM_ARQ_MODE;
+    params[idx++] = 1;
+    params[idx++] = options->arqMode;
+    params[idx++] = PARAM_WINDOW_SIZE;
+    params[idx++] = 1;
+    params[idx++] = options->windowSize;
+    params[idx++] = PARAM_FCS_MODE;
+    params[idx++] = 1;
+    params[idx++] = options->fcsMode;
+    params[idx++] = PARAM_MAX_PAYLOAD;
+    params[idx++] = 4;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        params[idx++] = (options->maxPayload >> shift) & 0xFF;
+    }
+    params[idx++] = PARAM_DUPLEX;
+    params[idx++] = 1;
+    params[idx++] = options->duplex ? 1 : 0;
+    params[idx++] = PARAM_FEC_ERRORS;
+    params[idx++] = 1;
+    params[idx++] = options->fecErrors;
+    // Left out unless asked for, so the rate is only raised when both sides offer one
+    if (options->maxBaudRate > 0) {
+        params[idx++] = PARAM_BAUD_RATE;
+        params[idx++] = 4;
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            params[idx++] = (options->maxBaudRate >> shift) & 0xFF;
         }
     }
-    return -1;
+    return idx;
+}
+
+// Unknown parameters are skipped so newer peers can add their own
+static void decode_link_params(const unsigned char *params, int length, LinkOptions *options) {
+    int idx = 0;
+    while (idx + 2 <= length) {
+        unsigned char type = params[idx++];
+        unsigned char len = params[idx++];
+        if (idx + len > length) break;
+
+        if (type == PARAM_ARQ_MODE && len == 1) {
+            options->arqMode = params[idx];
+        } else if (type == PARAM_WINDOW_SIZE && len == 1) {
+            options->windowSize = params[idx];
+        } else if (type == PARAM_FCS_MODE && len == 1) {
+            options->fcsMode = params[idx];
+        } else if (type == PARAM_MAX_PAYLOAD && len == 4) {
+            options->maxPayload = (params[idx] << 24) | (params[idx + 1] << 16) |
+                                  (params[idx + 2] << 8) | params[idx + 3];
+        } else if (type == PARAM_DUPLEX && len == 1) {
+            options->duplex = params[idx] != 0;
+        } else if (type == PARAM_FEC_ERRORS && len == 1) {
+            options->fecErrors = params[idx];
+        } else if (type == PARAM_BAUD_RATE && len == 4) {
+            options->maxBaudRate = (params[idx] << 24) | (params[idx + 1] << 16) |
+                                   (params[idx + 2] << 8) | params[idx + 3];
+        }
+        idx += len;
+    }
+}
+
+// Clamp options to what this implementation supports
+static void normalize_link_options(LinkOptions *options) {
+    if (options->arqMode != LlGoBackN && options->arqMode != LlSelectiveRepeat) {
+        options->arqMode = LlStopAndWait;
+        options->windowSize = 1;
+    }
+    if (options->windowSize < 1) options->windowSize = MAX_WINDOW_SIZE;
+    if (options->windowSize > MAX_WINDOW_SIZE) options->windowSize = MAX_WINDOW_SIZE;
+    if (options->fcsMode != LlFcsCrc16 && options->fcsMode != LlFcsCrc32c) {
+        options->fcsMode = LlFcsXor;
+    }
+    if (options->maxPayload < MAX_PAYLOAD_SIZE) options->maxPayload = MAX_PAYLOAD_SIZE;
+    if (options->maxPayload > MAX_PAYLOAD_LIMIT) options->maxPayload = MAX_PAYLOAD_LIMIT;
+    if (options->fecErrors < 0) options->fecErrors = 0;
+    if (options->fecErrors > MAX_FEC_ERRORS) options->fecErrors = MAX_FEC_ERRORS;
+    if (options->maxBaudRate < MIN_BAUD_RATE) options->maxBaudRate = 0;
+    if (options->maxBaudRate > MAX_BAUD_RATE) options->maxBaudRate = MAX_BAUD_RATE;
+}
+
+// Anything beyond plain stop-and-wait has to be agreed in SET/UA
+static int needs_negotiation(const LinkOptions *options) {
+    return options->arqMode != LlStopAndWait || options->fcsMode != LlFcsXor ||
+           options->maxPayload != MAX_PAYLOAD_SIZE || options->duplex || options->fecErrors > 0 ||
+           options->maxBaudRate > 0;
+}
+
+static const char *arq_mode_name(LinkArqMode mode) {
+    switch (mode) {
+        case LlGoBackN: return "Go-Back-N";
+        case LlSelectiveRepeat: return "Selective Repeat";
+        default: return "Stop-and-wait";
+    }
+}
+
+static const char *fcs_mode_name(LinkFcsMode mode) {
+    switch (mode) {
+        case LlFcsCrc16: return "CRC-16-CCITT";
+        case LlFcsCrc32c: return "CRC-32C";
+        default: return "XOR";
+    }
 }
 
 ////////////////////////////////////////////////
-// Connection setup
+// Frame buffers
 ////////////////////////////////////////////////
-static int setup_connection_transmitter(int fd) {
-    configure_alarm_handler();
+
+// Grow *buffer to hold size bytes; the old contents are kept
+static int reserve_buffer(unsigned char **buffer, int size) {
+    unsigned char *grown = realloc(*buffer, size);
+    if (grown == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    *buffer = grown;
+    return 0;
+}
+
+// Largest data field on the wire: payload and frame check, followed by
+// the FEC check bytes when FEC is on
+static int data_field_size(LinkSession *conn, int max_payload) {
+    int field = max_payload + MAX_FCS_SIZE;
+    return conn->fec_errors > 0 ? rs_encoded_size(field, 2 * conn->fec_errors) : field;
+}
+
+// Size the parser, window and reorder buffers for the given payload ceiling
+static int allocate_buffers(LinkSession *conn, int max_payload) {
+    int field = data_field_size(conn, max_payload);
+    if (reserve_buffer(&conn->parser.data, field) < 0) return -1;
+    conn->parser.capacity = field;
+    
+    // A duplex link both sends and receives I-frames
+    int sends = conn->role == LlTx || conn->duplex;
+    int receives = conn->role == LlRx || conn->duplex;
+    
+    if (sends && conn->fec_errors > 0 &&
+        reserve_buffer(&conn->fec_plain, max_payload + MAX_FCS_SIZE) < 0) {
+        return -1;
+    }
     
-    while (conn_state.retry_count < conn_state.max_retries) {
-        if (transmit_supervision_frame(fd, ADDR_SENDER, CTRL_SET) < 0) {
+    for (int i = 0; i < MAX_WINDOW_SIZE; i++) {
+        if (sends && reserve_buffer(&conn->tx_window[i].field, field) < 0) return -1;
+        if (receives && conn->arq_mode == LlSelectiveRepeat &&
+            reserve_buffer(&conn->rx_window[i].data, max_payload) < 0) {
             return -1;
         }
-        
-        conn_state.alarm_triggered = 0;
-        alarm(conn_state.timeout_duration);
-        
-        if (receive_supervision_frame(fd, CTRL_UA) == 0) {
-            alarm(0);
-            return 0;
-        }
-        
-        if (conn_state.alarm_triggered) {
-            conn_state.retry_count++;
-            printf("Timeout - retry %d/%d\n", conn_state.retry_count, conn_state.max_retries);
-        }
     }
-    
-    return -1;
+    for (int i = 0; i < INBOX_SIZE; i++) {
+        if (receives && reserve_buffer(&conn->inbox[i].data, max_payload) < 0) return -1;
+    }
+    return 0;
 }
 
-static int setup_connection_receiver(int fd) {
-    if (receive_supervision_frame(fd, CTRL_SET) < 0) {
-        return -1;
+static void release_buffers(LinkSession *conn) {
+    free(conn->parser.data);
+    conn->parser.data = NULL;
+    conn->parser.capacity = 0;
+    free(conn->fec_plain);
+    conn->fec_plain = NULL;
+    for (int i = 0; i < MAX_WINDOW_SIZE; i++) {
+        free(conn->tx_window[i].field);
+        conn->tx_window[i].field = NULL;
+        free(conn->tx_window[i].iov);
+        conn->tx_window[i].iov = NULL;
+        conn->tx_window[i].iov_capacity = 0;
+        free(conn->rx_window[i].data);
+        conn->rx_window[i].data = NULL;
     }
-    
-    return transmit_supervision_frame(fd, ADDR_RECEIVER, CTRL_UA);
+    for (int i = 0; i < INBOX_SIZE; i++) {
+        free(conn->inbox[i].data);
+        conn->inbox[i].data = NULL;
+    }
+}
+
+static int apply_link_options(LinkSession *conn, const LinkOptions *options) {
+    conn->fcs_mode = options->fcsMode;
+    conn->arq_mode = options->arqMode;
+    conn->window_size = options->windowSize;
+    conn->seq_modulus = options->arqMode == LlStopAndWait ? 2 : SEQ_MODULUS;
+    conn->max_payload = options->maxPayload;
+    conn->duplex = options->duplex;
+    conn->fec_errors = options->fecErrors;
+    return allocate_buffers(conn, options->maxPayload);
 }
 
 ////////////////////////////////////////////////
-// Public API
+// Frame transmission
 ////////////////////////////////////////////////
-int llopen(LinkLayer connectionParameters) {
-    conn_state.fd = openSerialPort(connectionParameters.serialPort,
-                                    connectionParameters.baudRate);
-    if (conn_state.fd < 0) return -1;
-    
-    conn_state.role = connectionParameters.role;
-    conn_state.timeout_duration = connectionParameters.timeout;
-    conn_state.max_retries = connectionParameters.nRetransmissions;
-    conn_state.retry_count = 0;
-    conn_state.current_sequence = 0;
-    
-    int result;
-    if (conn_state.role == LlTx) {
-        result = setup_connection_transmitter(conn_state.fd);
+
+// Address of the frames this side originates
+static unsigned char own_addr(LinkSession *conn) {
+    return conn->role == LlTx ? ADDR_SENDER : ADDR_RECEIVER;
+}
+
+// Duplex I-frames carry an RR between the control byte and BCC1
+static int frame_has_ack(LinkSession *conn, unsigned char ctrl) {
+    return conn->duplex && CTRL_TYPE(ctrl) == CTRL_TYPE_INFO;
+}
+
+// FEC protects I-frames only; SET and UA must be readable before it is agreed
+static int frame_uses_fec(LinkSession *conn, unsigned char ctrl) {
+    return conn->fec_errors > 0 && CTRL_TYPE(ctrl) == CTRL_TYPE_INFO;
+}
+
+// Opening flag and header, with the latest RR on duplex I-frames. Headers
+// go out as they are, except with XON/XOFF: control bytes and BCC1 can take
+// those values, so the header is stuffed like the data field.
+// Returns the number of bytes written to header (at most MAX_HEADER_SIZE).
+static int build_frame_header(LinkSession *conn, unsigned char addr, unsigned char ctrl,
+                              unsigned char *header) {
+    unsigned char fields[4];
+    int count = 0;
+    fields[count++] = addr;
+    fields[count++] = ctrl;
+    if (frame_has_ack(conn, ctrl)) {
+        fields[count++] = rr_ctrl(conn, conn->seq_expected);
+        fields[count++] = addr ^ ctrl ^ fields[2];
     } else {
-        result = setup_connection_receiver(conn_state.fd);
+        fields[count++] = addr ^ ctrl;
     }
     
-    return result == 0 ? conn_state.fd : -1;
+    header[0] = FRAME_FLAG;
+    if (conn->escape_flow) return 1 + stuff_bytes(fields, count, header + 1, TRUE);
+    memcpy(header + 1, fields, count);
+    return 1 + count;
 }
 
-int llwrite(const unsigned char *buf, int bufSize) {
-    if (bufSize <= 0 || bufSize > MAX_PAYLOAD_SIZE) {
-        return -1;
+static int build_supervision_frame(LinkSession *conn, unsigned char addr, unsigned char ctrl,
+                                   unsigned char *frame) {
+    int size = build_frame_header(conn, addr, ctrl, frame);
+    frame[size++] = FRAME_FLAG;
+    return size;
+}
+
+static int transmit_supervision_frame(LinkSession *conn, unsigned char addr, unsigned char ctrl) {
+    unsigned char frame[MAX_HEADER_SIZE + 1];
+    int size = build_supervision_frame(conn, addr, ctrl, frame);
+    
+    ssize_t result = write_all(conn->fd, frame, size);
+    if (result > 0) note_written(conn, result);
+    return result == size ? 0 : -1;
+}
+
+// Acknowledge every frame before seq_expected. On a duplex link the RR waits
+// for the next I-frame going the other way, or until this side blocks.
+static void acknowledge(LinkSession *conn) {
+    if (conn->duplex) {
+        conn->ack_pending = TRUE;
+    } else {
+        transmit_supervision_frame(conn, own_addr(conn), rr_ctrl(conn, conn->seq_expected));
+        trace_event(conn->trace_id, TRACE_RR_TX, conn->seq_expected, 0);
     }
+}
+
+static void flush_acknowledgement(LinkSession *conn) {
+    if (!conn->ack_pending) return;
+    conn->ack_pending = FALSE;
+    transmit_supervision_frame(conn, own_addr(conn), rr_ctrl(conn, conn->seq_expected));
+    trace_event(conn->trace_id, TRACE_RR_TX, conn->seq_expected, 0);
+}
+
+// Contiguous frame with a data field, for the SET and UA carrying link
+// parameters; I-frames are laid out in their window slot instead
+static int build_information_frame(LinkSession *conn, unsigned char addr, unsigned char ctrl,
+                                   const unsigned char *data, int length, unsigned char *frame) {
+    // Start flag and header
+    int frame_idx = build_frame_header(conn, addr, ctrl, frame);
     
-    unsigned char frame[MAX_PAYLOAD_SIZE * 2 + 10];
-    int frame_size = build_information_frame(buf, bufSize, frame);
+    // Calculate BCC2
+    unsigned char bcc2[MAX_FCS_SIZE];
+    int bcc2_size = fcs_compute(frame_fcs_mode(conn, ctrl), data, length, bcc2);
     
-    if (frame_size < 0) {
-        return -1;
-    }
+    // Stuff data and BCC2
+    frame_idx += stuff_bytes(data, length, &frame[frame_idx], conn->escape_flow);
+    frame_idx += stuff_bytes(bcc2, bcc2_size, &frame[frame_idx], conn->escape_flow);
     
-    configure_alarm_handler();
+    // End flag
+    frame[frame_idx++] = FRAME_FLAG;
     
-    int retry_count = 0;
-    while (retry_count < conn_state.max_retries) {
-        printf("Attempt %d/%d: sending frame (%d bytes)...\n", 
-               retry_count + 1, conn_state.max_retries, frame_size);
-        
-        // Send frame with robust I/O (write_all now retries EIO)
-        ssize_t bytes_written = write_all(conn_state.fd, frame, frame_size);
-        if (bytes_written != frame_size) {
-            // write_all failed after internal retries - this is likely fatal
-            printf("Write failed after retries (sent %ld/%d bytes)\n", bytes_written, frame_size);
-            retry_count++;
-            
-            // Don't give up immediately - the alarm/retry logic may still recover
-            if (bytes_written < 0) {
-                // Total write failure - wait longer before next attempt
-                sleep(1);
-            } else {
-                // Partial write - shorter backoff
-                usleep(500000);  // 500ms
-            }
-            continue;
-        }
-        
-        // Wait for RR/REJ response with timeout
-        conn_state.alarm_triggered = 0;
-        alarm(conn_state.timeout_duration);
-        
-        unsigned char response[5] = {0};
-        ssize_t bytes_read = read_bytes(conn_state.fd, response, 5, conn_state.timeout_duration);
-        alarm(0);
-        
-        if (bytes_read < 5) {
-            printf("Incomplete response (%ld bytes), timeout or error\n", bytes_read);
-            retry_count++;
-            usleep(200000);
-            continue;
-        }
-        
-        // Validate response frame structure
-        if (response[0] != FRAME_FLAG || response[4] != FRAME_FLAG) {
-            printf("Invalid response frame structure\n");
-            retry_count++;
-            continue;
-        }
-        
-        unsigned char addr = response[1];
-        unsigned char ctrl = response[2];
-        unsigned char bcc = response[3];
-        
-        // Verify BCC
-        if (bcc != (addr ^ ctrl)) {
-            printf("Response BCC error\n");
-            retry_count++;
-            continue;
-        }
-        
-        // Handle RR - success, toggle sequence
-        if (ctrl == CTRL_RR(!conn_state.current_sequence)) {
-            printf("Received RR (seq %d), frame accepted\n", !conn_state.current_sequence);
-            conn_state.current_sequence = !conn_state.current_sequence;
-            return bufSize;
-        }
-        
-        // Handle REJ - resend same frame (but count as retry)
-        if (ctrl == CTRL_REJ(conn_state.current_sequence)) {
-            printf("Received REJ (seq %d), retransmitting...\n", conn_state.current_sequence);
-            retry_count++;
-            usleep(200000);
-            continue;
+    return frame_idx;
+}
+
+// Stuffed forms of the bytes that need escaping, and the end flag, for the
+// iovecs of every I-frame to point at
+static unsigned char escaped_flag[2] = {ESCAPE_BYTE, FRAME_FLAG ^ 0x20};
+static unsigned char escaped_escape[2] = {ESCAPE_BYTE, ESCAPE_BYTE ^ 0x20};
+static unsigned char escaped_xon[2] = {ESCAPE_BYTE, XON_BYTE ^ 0x20};
+static unsigned char escaped_xoff[2] = {ESCAPE_BYTE, XOFF_BYTE ^ 0x20};
+static unsigned char end_flag[1] = {FRAME_FLAG};
+
+static unsigned char *escaped_form(unsigned char byte) {
+    switch (byte) {
+        case FRAME_FLAG: return escaped_flag;
+        case XON_BYTE: return escaped_xon;
+        case XOFF_BYTE: return escaped_xoff;
+        default: return escaped_escape;
+    }
+}
+
+static int add_iov(WindowSlot *slot, unsigned char *base, int length) {
+    if (slot->iov_count == slot->iov_capacity) {
+        int capacity = slot->iov_capacity > 0 ? slot->iov_capacity * 2 : 64;
+        struct iovec *grown = realloc(slot->iov, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
         }
-        
-        printf("Unexpected control byte: 0x%02X\n", ctrl);
-        retry_count++;
+        slot->iov = grown;
+        slot->iov_capacity = capacity;
     }
-    
-    printf("Failed to send frame after %d attempts\n", conn_state.max_retries);
-    return -1;
+    slot->iov[slot->iov_count].iov_base = base;
+    slot->iov[slot->iov_count].iov_len = length;
+    slot->iov_count++;
+    slot->size += length;
+    return 0;
 }
 
-int llread(unsigned char *packet) {
-    unsigned char frame[MAX_PAYLOAD_SIZE * 2 + 10];
-    int frame_idx = 0;
-    unsigned char byte;
-    int in_escape = 0;
+// Lay out an I-frame in its window slot. The payload is copied once, into
+// the data field kept for retransmissions (FEC encodes it from a second
+// buffer); stuffing only adds iovecs, so writev() gathers the frame straight
+// from the field.
+static int prepare_information_frame(LinkSession *conn, WindowSlot *slot, unsigned char ctrl,
+                                     const unsigned char *data, int length) {
+    // A piggybacked RR is filled in again whenever the frame is (re)sent
+    slot->ctrl = ctrl;
+    int header_size = build_frame_header(conn, own_addr(conn), ctrl, slot->header);
     
-    enum { WAIT_START_FLAG, READ_ADDR, READ_CTRL, READ_BCC1, READ_DATA, CHECK_END_FLAG } state = WAIT_START_FLAG;
+    int field_size;
+    if (frame_uses_fec(conn, ctrl)) {
+        // The FEC covers BCC2 as well, so BCC2 still vouches for any repair
+        memcpy(conn->fec_plain, data, length);
+        int bcc2_size = fcs_compute(conn->fcs_mode, data, length, conn->fec_plain + length);
+        field_size = rs_encode(conn->fec_plain, length + bcc2_size, 2 * conn->fec_errors, slot->field);
+    } else {
+        memcpy(slot->field, data, length);
+        field_size = length + fcs_compute(conn->fcs_mode, data, length, slot->field + length);
+    }
     
-    unsigned char addr, ctrl, bcc1;
+    slot->iov_count = 0;
+    slot->size = 0;
+    slot->stuffing = 0;
+    if (add_iov(slot, slot->header, header_size) < 0) return -1;
     
-    while (1) {
-        if (read(conn_state.fd, &byte, 1) != 1) {
-            continue;
+    int idx = 0;
+    while (idx < field_size) {
+        int run = stuff_run_length(slot->field + idx, field_size - idx, conn->escape_flow);
+        if (run > 0 && add_iov(slot, slot->field + idx, run) < 0) return -1;
+        idx += run;
+        if (idx < field_size) {
+            if (add_iov(slot, escaped_form(slot->field[idx]), 2) < 0) return -1;
+            slot->stuffing++;
+            idx++;
         }
-        
-        switch (state) {
-            case WAIT_START_FLAG:
-                if (byte == FRAME_FLAG) {
-                    frame_idx = 0;
-                    in_escape = 0;
-                    state = READ_ADDR;
-                }
-                break;
-                
-            case READ_ADDR:
-                if (byte == FRAME_FLAG) {
-                    state = READ_ADDR; // Still waiting for address
-                } else {
-                    addr = byte;
-                    state = READ_CTRL;
-                }
-                break;
-                
-            case READ_CTRL:
-                if (byte == FRAME_FLAG) {
-                    state = WAIT_START_FLAG;
-                } else {
-                    ctrl = byte;
-                    state = READ_BCC1;
-                }
+    }
+    return add_iov(slot, end_flag, 1);
+}
+
+////////////////////////////////////////////////
+// Frame reception
+////////////////////////////////////////////////
+// A flag in the middle of a header: drop the partial frame, the flag opens the next
+static void resync_parser(LinkSession *conn, FrameParser *parser) {
+    trace_event(conn->trace_id, TRACE_RESYNC, 0, parser->state);
+    parser->state = READ_ADDR;
+}
+
+// A data field that failed its check (or could not be repaired)
+static FrameEvent reject_data_field(LinkSession *conn, FrameParser *parser) {
+    conn->bcc2_errors++;
+    trace_event(conn->trace_id, TRACE_BCC2_ERROR, info_seq(conn, parser->ctrl), 0);
+    return FRAME_BAD_DATA;
+}
+
+static FrameEvent parse_frame_byte(LinkSession *conn, FrameParser *parser, unsigned char byte) {
+    // With XON/XOFF the header is stuffed too; a flag cancels any escape
+    if (conn->escape_flow && parser->state != WAIT_FLAG && parser->state != READ_DATA) {
+        if (byte == FRAME_FLAG) {
+            parser->in_escape = 0;
+        } else if (parser->in_escape) {
+            byte ^= 0x20;
+            parser->in_escape = 0;
+        } else if (byte == ESCAPE_BYTE) {
+            parser->in_escape = 1;
+            return FRAME_NONE;
+        }
+    }
+    
+    switch (parser->state) {
+        case WAIT_FLAG:
+            if (byte == FRAME_FLAG) {
+                parser->state = READ_ADDR;
+                parser->in_escape = 0;
+            }
+            break;
+        case READ_ADDR:
+            if (byte == FRAME_FLAG) break;
+            parser->addr = byte;
+            parser->state = READ_CTRL;
+            break;
+        case READ_CTRL:
+            if (byte == FRAME_FLAG) { resync_parser(conn, parser); break; }
+            parser->ctrl = byte;
+            parser->ack = 0;
+            parser->state = frame_has_ack(conn, byte) ? READ_ACK : READ_BCC1;
+            break;
+        case READ_ACK:
+            if (byte == FRAME_FLAG) { resync_parser(conn, parser); break; }
+            parser->ack = byte;
+            parser->state = READ_BCC1;
+            break;
+        case READ_BCC1:
+            if (byte == FRAME_FLAG) { resync_parser(conn, parser); break; }
+            if (byte != (parser->addr ^ parser->ctrl ^ parser->ack)) {
+                printf("BCC1 error\n");
+                conn->bcc1_errors++;
+                trace_event(conn->trace_id, TRACE_BCC1_ERROR, 0, parser->ctrl);
+                parser->state = WAIT_FLAG;
                 break;
-                
-            case READ_BCC1:
-                if (byte == FRAME_FLAG) {
-                    state = WAIT_START_FLAG;
-                } else {
-                    bcc1 = byte;
-                    // Verify BCC1
-                    if (bcc1 != (addr ^ ctrl)) {
-                        printf("BCC1 error\n");
-                        state = WAIT_START_FLAG;
-                    } else {
-                        // Check if this is a supervision frame (DISC, RR, REJ)
-                        if (ctrl == CTRL_DISC) {
-                            return 0; // Signal disconnection
-                        } else if ((ctrl & 0x0F) == 0x05 || (ctrl & 0x0F) == 0x01) {
-                            // RR or REJ - ignore in llread
-                            state = WAIT_START_FLAG;
-                        } else {
-                            state = READ_DATA;
-                        }
+            }
+            parser->length = 0;
+            parser->in_escape = 0;
+            parser->state = READ_DATA;
+            break;
+        case READ_DATA:
+            if (byte == FRAME_FLAG) {
+                // The closing flag may also open the next frame, and ends
+                // an escape a damaged field left open
+                parser->state = READ_ADDR;
+                parser->in_escape = 0;
+                if (parser->length == 0) return FRAME_SUPERVISION;
+
+                // Repair what the FEC can before BCC2 has its say
+                int repaired = 0;
+                if (frame_uses_fec(conn, parser->ctrl)) {
+                    int decoded = rs_decode(parser->data, parser->length,
+                                            2 * conn->fec_errors, &repaired);
+                    if (decoded < 0) {
+                        printf("FEC: too many errors to repair\n");
+                        return reject_data_field(conn, parser);
                     }
+                    parser->length = decoded;
                 }
-                break;
+
+                // Last bytes are BCC2
+                LinkFcsMode mode = frame_fcs_mode(conn, parser->ctrl);
+                int bcc2_size = fcs_size(mode);
+                if (parser->length < bcc2_size) return reject_data_field(conn, parser);
+                parser->length -= bcc2_size;
                 
-            case READ_DATA:
-                if (byte == FRAME_FLAG) {
-                    // End of frame - destuff and verify BCC2
-                    if (frame_idx < 1) {
-                        state = WAIT_START_FLAG;
-                        break;
-                    }
-                    
-                    // Last byte should be BCC2
-                    unsigned char received_bcc2 = frame[frame_idx - 1];
-                    frame_idx--;
-                    
-                    // Calculate BCC2 on actual data
-                    unsigned char calculated_bcc2 = 0;
-                    for (int i = 0; i < frame_idx; i++) {
-                        calculated_bcc2 ^= frame[i];
-                    }
-                    
-                    if (calculated_bcc2 != received_bcc2) {
-                        printf("BCC2 error: expected 0x%02X, got 0x%02X\n", 
-                               calculated_bcc2, received_bcc2);
-                        // Send REJ
-                        transmit_supervision_frame(conn_state.fd, ADDR_RECEIVER, 
-                                                  CTRL_REJ(conn_state.current_sequence));
-                        state = WAIT_START_FLAG;
-                        break;
-                    }
-                    
-                    // Check sequence number
-                    unsigned char expected_ctrl = CTRL_INFO(conn_state.current_sequence);
-                    if (ctrl != expected_ctrl) {
-                        printf("Wrong sequence: expected %d, got %d\n", 
-                               conn_state.current_sequence, (ctrl >> 6) & 1);
-                        // Send RR for next expected
-                        transmit_supervision_frame(conn_state.fd, ADDR_RECEIVER,
-                                                  CTRL_RR(!conn_state.current_sequence));
-                        state = WAIT_START_FLAG;
-                        break;
-                    }
-                    
-                    // Success - copy data and send RR
-                    memcpy(packet, frame, frame_idx);
-                    transmit_supervision_frame(conn_state.fd, ADDR_RECEIVER,
-                                              CTRL_RR(!conn_state.current_sequence));
-                    conn_state.current_sequence = !conn_state.current_sequence;
-                    
-                    return frame_idx;
-                } else {
-                    // Handle byte stuffing
-                    if (in_escape) {
-                        frame[frame_idx++] = byte ^ 0x20;
-                        in_escape = 0;
-                    } else if (byte == ESCAPE_BYTE) {
-                        in_escape = 1;
-                    } else {
-                        frame[frame_idx++] = byte;
-                    }
-                    
-                    // Prevent buffer overflow
-                    if (frame_idx >= MAX_PAYLOAD_SIZE * 2) {
-                        printf("Frame too large\n");
-                        state = WAIT_START_FLAG;
-                    }
+                unsigned char calculated_bcc2[MAX_FCS_SIZE];
+                fcs_compute(mode, parser->data, parser->length, calculated_bcc2);
+                if (memcmp(calculated_bcc2, &parser->data[parser->length], bcc2_size) != 0) {
+                    printf("BCC2 error: %s check failed\n", fcs_mode_name(mode));
+                    return reject_data_field(conn, parser);
                 }
+                conn->fec_repaired += repaired;
+                return FRAME_INFO;
+            }
+
+            // Prevent buffer overflow
+            if (parser->length >= parser->capacity) {
+                printf("Frame too large\n");
+                trace_event(conn->trace_id, TRACE_RESYNC, 0, parser->state);
+                parser->state = WAIT_FLAG;
                 break;
-                
-            case CHECK_END_FLAG:
-                // Not used in this implementation
-                break;
+            }
+
+            // Handle byte stuffing
+            if (parser->in_escape) {
+                parser->data[parser->length++] = byte ^ 0x20;
+                parser->in_escape = 0;
+            } else if (byte == ESCAPE_BYTE) {
+                parser->in_escape = 1;
+            } else {
+                parser->data[parser->length++] = byte;
+            }
+            break;
+    }
+    return FRAME_NONE;
+}
+
+// Pull everything the driver has into the free space of the receive ring
+// with a single read(). Only called once the port polled ready, so it does
+// not block. Returns the read() result.
+static ssize_t fill_rx_ring(LinkSession *conn) {
+    RxRing *ring = &conn->rx_ring;
+    int tail = (ring->head + ring->count) % RX_RING_SIZE;
+    int space = RX_RING_SIZE - ring->count;
+    
+    // Only the contiguous part; the rest is picked up by the next call
+    if (tail + space > RX_RING_SIZE) space = RX_RING_SIZE - tail;
+    
+    ssize_t n = readBytesSerialPortFd(conn->fd, ring->data + tail, space, -1);
+    if (n > 0) {
+        ring->count += n;
+        conn->wire_bytes_received += n;
+    }
+    return n;
+}
+
+// Feed buffered bytes to the parser until a frame completes or the ring runs dry
+static FrameEvent parse_rx_ring(LinkSession *conn) {
+    RxRing *ring = &conn->rx_ring;
+    
+    while (ring->count > 0) {
+        // Inside a data field, destuff everything up to the closing flag in bulk
+        if (conn->parser.state == READ_DATA) {
+            FrameParser *parser = &conn->parser;
+            int span = ring->head + ring->count > RX_RING_SIZE ? RX_RING_SIZE - ring->head
+                                                               : ring->count;
+            int written;
+            int used = destuff_bytes(ring->data + ring->head, span,
+                                     parser->data + parser->length,
+                                     parser->capacity - parser->length,
+                                     &written, &parser->in_escape);
+            parser->length += written;
+            ring->head = (ring->head + used) % RX_RING_SIZE;
+            ring->count -= used;
+            
+            // Stopped early: the flag (or an overflowing byte) goes through the parser
+            if (used == span) continue;
         }
+        
+        unsigned char byte = ring->data[ring->head];
+        ring->head = (ring->head + 1) % RX_RING_SIZE;
+        ring->count--;
+        
+        FrameEvent event = parse_frame_byte(conn, &conn->parser, byte);
+        if (event == FRAME_SUPERVISION || event == FRAME_INFO) conn->last_valid_us = now_us();
+        if (event != FRAME_NONE) return event;
+    }
+    return FRAME_NONE;
+}
+
+// Block until a complete frame arrives or the timer expires
+static FrameEvent receive_frame(LinkSession *conn) {
+    while (1) {
+        // Bytes left over from the last read() may already hold a frame
+        FrameEvent event = parse_rx_ring(conn);
+        if (event != FRAME_NONE) return event;
+        
+        if (conn->timer_expired) return FRAME_NONE;
+        
+        // About to block: an RR held back for piggybacking goes out now
+        flush_acknowledgement(conn);
+        if (!wait_for_input(conn, TRUE, baud_watchdog_ms(conn))) continue;
+        
+        if (fill_rx_ring(conn) <= 0) {
+            // Cable unplugged (EIO/hangup): back off, but still watch the timer
+            wait_for_input(conn, FALSE, 50);
+        }
+    }
+}
+
+// Parse whatever is already waiting on the port without blocking
+static FrameEvent poll_frame(LinkSession *conn) {
+    while (1) {
+        FrameEvent event = parse_rx_ring(conn);
+        if (event != FRAME_NONE) return event;
+        
+        if (!wait_for_input(conn, TRUE, 0)) return FRAME_NONE;
+        if (fill_rx_ring(conn) <= 0) return FRAME_NONE;
+    }
+}
+
+static int receive_supervision_frame(LinkSession *conn, unsigned char expected_ctrl) {
+    FrameEvent event;
+    while ((event = receive_frame(conn)) != FRAME_NONE) {
+        unsigned char ctrl = conn->parser.ctrl;
+        if (event == FRAME_SUPERVISION && ctrl == expected_ctrl) return 0;
+        
+        // The peer is still resending an I-frame, so our RR was lost
+        if (event == FRAME_INFO && CTRL_TYPE(ctrl) == CTRL_TYPE_INFO) {
+            conn->duplicates++;
+            trace_event(conn->trace_id, TRACE_DUPLICATE, info_seq(conn, ctrl), 0);
+            transmit_supervision_frame(conn, own_addr(conn), rr_ctrl(conn, conn->seq_expected));
+        }
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////
+// Transmit window
+////////////////////////////////////////////////
+static int frames_in_flight(LinkSession *conn) {
+    return seq_distance(conn, conn->seq_base, conn->seq_end);
+}
+
+// The timer always covers the oldest unacknowledged frame, counting from
+// when it left the port: frames queued behind others, or large ones at low
+// baud rates, are not timed while they wait to go out.
+static void restart_timer(LinkSession *conn) {
+    if (frames_in_flight(conn) > 0) {
+        WindowSlot *slot = &conn->tx_window[conn->seq_base % MAX_WINDOW_SIZE];
+        arm_timer_after(conn, slot->departed_us, conn->rto_ms);
+    } else {
+        disarm_timer(conn);
+    }
+}
+
+static void send_slot(LinkSession *conn, int seq) {
+    WindowSlot *slot = &conn->tx_window[seq % MAX_WINDOW_SIZE];
+    
+    if (conn->duplex) {
+        // Piggyback the latest acknowledgement; BCC1 covers it, and escaping
+        // may change the header's length
+        int header_size = build_frame_header(conn, own_addr(conn), slot->ctrl, slot->header);
+        slot->size += header_size - (int)slot->iov[0].iov_len;
+        slot->iov[0].iov_len = header_size;
+        conn->ack_pending = FALSE;
+    }
+    
+    if (slot->transmissions == 0) note_baud_event(conn, FALSE);
+    ssize_t bytes_written = writev_all(conn->fd, slot->iov, slot->iov_count);
+    if (bytes_written != slot->size) {
+        // Left to the retransmission timer
+        printf("Write failed for frame %d (sent %ld/%d bytes)\n",
+               seq, bytes_written, slot->size);
+    }
+    if (bytes_written > 0) {
+        conn->wire_bytes_sent += bytes_written;
+        note_written(conn, bytes_written);
     }
+    trace_event(conn->trace_id, slot->transmissions > 0 ? TRACE_FRAME_RETX : TRACE_FRAME_TX,
+                seq, slot->size);
+    conn->stuffing_bytes += slot->stuffing;
+    slot->transmissions++;
+    slot->departed_us = departure_us(conn);
     
+    if (seq == conn->seq_base) restart_timer(conn);
+}
+
+// Put every queued frame from seq_next onwards on the wire
+static void transmit_window(LinkSession *conn) {
+    while (conn->seq_next != conn->seq_end) {
+        send_slot(conn, conn->seq_next);
+        conn->seq_next = seq_add(conn, conn->seq_next, 1);
+    }
+}
+
+// Count one more retransmission of frame seq. Returns 0 to resend it, -1
+// once it has used up its attempts and the link failed, or 1 when errors
+// piled up at a negotiated baud rate (too many of the recent frames, or all
+// attempts of this one): the link then falls back to the opening rate and
+// resends once the receiver has had time to do the same.
+static int charge_retry(LinkSession *conn, int seq) {
+    WindowSlot *slot = &conn->tx_window[seq % MAX_WINDOW_SIZE];
+    slot->retries++;
+    int spiked = note_baud_event(conn, TRUE);
+    if (!spiked && slot->retries < conn->max_retries) return 0;
+    
+    if (conn->baud_rate != conn->base_baud_rate) {
+        if (spiked) {
+            printf("%d errors in the last 32 frames at %d baud\n",
+                   __builtin_popcount(conn->baud_errors), conn->baud_rate);
+        } else {
+            printf("Frame %d failed %d times at %d baud\n", seq, conn->max_retries, conn->baud_rate);
+        }
+        fall_back_baud_rate(conn);
+        for (int i = 0; i < MAX_WINDOW_SIZE; i++) conn->tx_window[i].retries = 0;
+        arm_timer(conn, BAUD_FALLBACK_MS + conn->rto_ms);
+        return 1;
+    }
+    
+    printf("Failed to send frame %d after %d attempts\n", seq, conn->max_retries);
+    conn->link_failed = TRUE;
+    disarm_timer(conn);
     return -1;
 }
-int llclose(int showStatistics) {
+
+// Resend every outstanding frame starting at seq (Go-Back-N)
+static int go_back(LinkSession *conn, int seq) {
+    int charged = charge_retry(conn, seq);
+    if (charged != 0) return charged < 0 ? -1 : 0;
+    
+    conn->retransmissions += seq_distance(conn, seq, conn->seq_next);
+    conn->seq_next = seq;
+    transmit_window(conn);
+    return 0;
+}
+
+// Resend frame seq alone (Selective Repeat)
+static int resend_frame(LinkSession *conn, int seq) {
+    int charged = charge_retry(conn, seq);
+    if (charged != 0) return charged < 0 ? -1 : 0;
+    
+    conn->retransmissions++;
+    send_slot(conn, seq);
+    return 0;
+}
+
+// Apply an RR, REJ or SREJ from the receiver to the window
+static int handle_acknowledgement(LinkSession *conn, unsigned char ctrl) {
+    int type = CTRL_TYPE(ctrl);
+    if (type != CTRL_TYPE_RR && type != CTRL_TYPE_REJ && type != CTRL_TYPE_SREJ) {
+        printf("Unexpected control byte: 0x%02X\n", ctrl);
+        return 0;
+    }
+    
+    int nr = ack_seq(conn, ctrl);
+    int acked = seq_distance(conn, conn->seq_base, nr);
+    
+    // SREJ names a single missing frame and acknowledges nothing
+    if (type == CTRL_TYPE_SREJ) {
+        if (acked >= seq_distance(conn, conn->seq_base, conn->seq_next)) return 0;
+        printf("Received SREJ (seq %d), retransmitting it...\n", nr);
+        conn->rejects++;
+        trace_event(conn->trace_id, TRACE_SREJ_RX, nr, 0);
+        return resend_frame(conn, nr);
+    }
+    
+    if (acked > frames_in_flight(conn)) {
+        printf("Ignoring acknowledgement %d outside the window\n", nr);
+        return 0;
+    }
+    
+    if (acked > 0) {
+        // Time the newest frame acknowledged, unless it was sent more than
+        // once and the RR could belong to either copy (Karn)
+        WindowSlot *newest = &conn->tx_window[seq_add(conn, nr, conn->seq_modulus - 1) % MAX_WINDOW_SIZE];
+        if (newest->transmissions == 1) {
+            long sample_us = now_us() - newest->departed_us;
+            update_rtt(conn, sample_us > 0 ? sample_us : 0);
+        }
+        
+        if (seq_distance(conn, conn->seq_base, conn->seq_next) < acked) {
+            conn->seq_next = nr;
+        }
+        conn->seq_base = nr;
+        conn->frames_acked += acked;
+        restart_timer(conn);
+    }
+    
+    if (type == CTRL_TYPE_RR) {
+        trace_event(conn->trace_id, TRACE_RR_RX, nr, acked);
+        if (acked > 0) printf("Received RR (seq %d), %d frame(s) accepted\n", nr, acked);
+        return 0;
+    }
+    
+    printf("Received REJ (seq %d), retransmitting...\n", nr);
+    conn->rejects++;
+    trace_event(conn->trace_id, TRACE_REJ_RX, nr, acked);
+    return go_back(conn, nr);
+}
+
+// Resend after the timer expired on the oldest unacknowledged frame
+static int handle_timeout(LinkSession *conn) {
+    if (!conn->timer_expired) return 0;
+    if (frames_in_flight(conn) == 0) {
+        conn->timer_expired = FALSE;
+        return 0;
+    }
+    
+    {
+        WindowSlot *slot = &conn->tx_window[conn->seq_base % MAX_WINDOW_SIZE];
+        back_off_rto(conn);
+        conn->timeouts++;
+        trace_event(conn->trace_id, TRACE_TIMEOUT, conn->seq_base, conn->rto_ms);
+        printf("Timeout - resending frame %d (retry %d/%d, timeout now %d ms)\n",
+               conn->seq_base, slot->retries + 1, conn->max_retries,
+               conn->rto_ms);
+        if (conn->arq_mode == LlSelectiveRepeat) return resend_frame(conn, conn->seq_base);
+        return go_back(conn, conn->seq_base);
+    }
+}
+
+////////////////////////////////////////////////
+// Receive window
+////////////////////////////////////////////////
+
+static void push_inbox(LinkSession *conn, const unsigned char *data, int length) {
+    InboxSlot *slot = &conn->inbox[(conn->inbox_head + conn->inbox_count) % INBOX_SIZE];
+    memcpy(slot->data, data, length);
+    slot->length = length;
+    conn->inbox_count++;
+    conn->frames_received++;
+    conn->bytes_received += length;
+    trace_event(conn->trace_id, TRACE_FRAME_RX, conn->seq_expected, length);
+}
+
+// Ask for frame seq again: SREJ for that frame alone, or REJ for it and
+// everything after it
+static void send_reject(LinkSession *conn, unsigned char ctrl) {
+    transmit_supervision_frame(conn, own_addr(conn), ctrl);
+    conn->rejects_sent++;
+    trace_event(conn->trace_id, CTRL_TYPE(ctrl) == CTRL_TYPE_SREJ ? TRACE_SREJ_TX : TRACE_REJ_TX,
+                ack_seq(conn, ctrl), 0);
+}
+
+static void advance_expected(LinkSession *conn) {
+    ReorderSlot *slot = &conn->rx_window[conn->seq_expected % MAX_WINDOW_SIZE];
+    slot->valid = FALSE;
+    slot->srej_sent = FALSE;
+    
+    conn->seq_expected = seq_add(conn, conn->seq_expected, 1);
+    conn->rej_sent = FALSE;
+}
+
+// Move frames Selective Repeat reordered into the inbox while it has room.
+// They are only acknowledged once moved, so the sender never gets ahead of
+// the receive window.
+static int drain_reorder_buffer(LinkSession *conn) {
+    int moved = 0;
+    while (conn->inbox_count < INBOX_SIZE &&
+           conn->rx_window[conn->seq_expected % MAX_WINDOW_SIZE].valid) {
+        ReorderSlot *slot = &conn->rx_window[conn->seq_expected % MAX_WINDOW_SIZE];
+        push_inbox(conn, slot->data, slot->length);
+        advance_expected(conn);
+        moved++;
+    }
+    return moved;
+}
+
+// Buffer an out-of-order frame and ask once for each one still missing before it
+static void reorder_frame(LinkSession *conn, int seq, int offset) {
+    ReorderSlot *slot = &conn->rx_window[seq % MAX_WINDOW_SIZE];
+    if (!slot->valid) {
+        printf("Frame %d buffered, waiting for %d\n", seq, conn->seq_expected);
+        memcpy(slot->data, conn->parser.data, conn->parser.length);
+        slot->length = conn->parser.length;
+        slot->valid = TRUE;
+    } else {
+        conn->duplicates++;
+        trace_event(conn->trace_id, TRACE_DUPLICATE, seq, 0);
+    }
+    for (int i = 0; i < offset; i++) {
+        int missing = seq_add(conn, conn->seq_expected, i);
+        ReorderSlot *gap = &conn->rx_window[missing % MAX_WINDOW_SIZE];
+        if (!gap->valid && !gap->srej_sent) {
+            send_reject(conn, CTRL_SREJ_N(missing));
+            gap->srej_sent = TRUE;
+        }
+    }
+}
+
+// Run a received I-frame through the receive window
+static void receive_information(LinkSession *conn, FrameEvent event) {
+    int seq = info_seq(conn, conn->parser.ctrl);
+    int offset = seq_distance(conn, conn->seq_expected, seq);
+    int in_window = offset < conn->window_size;
+    
+    if (event == FRAME_BAD_DATA) {
+        if (conn->arq_mode == LlSelectiveRepeat) {
+            if (in_window && !conn->rx_window[seq % MAX_WINDOW_SIZE].valid) {
+                send_reject(conn, CTRL_SREJ_N(seq));
+                conn->rx_window[seq % MAX_WINDOW_SIZE].srej_sent = TRUE;
+            }
+        } else if (offset == 0) {
+            send_reject(conn, rej_ctrl(conn, conn->seq_expected));
+            conn->rej_sent = TRUE;
+        }
+        return;
+    }
+    
+    if (offset == 0 && conn->inbox_count == INBOX_SIZE) {
+        // llread() is behind. Selective Repeat keeps the frame for later; the
+        // other modes leave it to the sender's timer rather than asking for it
+        // again right away.
+        if (conn->arq_mode == LlSelectiveRepeat) {
+            reorder_frame(conn, seq, 0);
+        } else {
+            conn->rej_sent = TRUE;
+        }
+        return;
+    }
+    
+    if (offset == 0) {
+        push_inbox(conn, conn->parser.data, conn->parser.length);
+        advance_expected(conn);
+        drain_reorder_buffer(conn);
+        acknowledge(conn);
+    } else if (in_window && conn->arq_mode == LlSelectiveRepeat) {
+        reorder_frame(conn, seq, offset);
+    } else if (in_window) {
+        // A later frame of the window got through, so the expected one was lost
+        if (!conn->rej_sent) {
+            printf("Frame %d out of order, expected %d\n", seq, conn->seq_expected);
+            send_reject(conn, rej_ctrl(conn, conn->seq_expected));
+            conn->rej_sent = TRUE;
+        }
+    } else {
+        // Duplicate: our RR was lost, acknowledge again
+        printf("Wrong sequence: expected %d, got %d\n", conn->seq_expected, seq);
+        conn->duplicates++;
+        trace_event(conn->trace_id, TRACE_DUPLICATE, seq, 0);
+        acknowledge(conn);
+    }
+}
+
+////////////////////////////////////////////////
+// Event loop
+////////////////////////////////////////////////
+
+// Hand a received frame to the transmit or receive side
+static int dispatch_frame(LinkSession *conn, FrameEvent event) {
+    unsigned char ctrl = conn->parser.ctrl;
+    
+    if (ctrl == CTRL_DISC && event == FRAME_SUPERVISION) {
+        conn->disc_received = TRUE;
+        return 0;
+    }
+    
+    if (ctrl == CTRL_SET) {
+        // Our UA was lost and the transmitter is still opening
+        if (event != FRAME_BAD_DATA && conn->ua_size > 0) {
+            if (write_all(conn->fd, conn->ua_frame, conn->ua_size) > 0) note_written(conn, conn->ua_size);
+        }
+        return 0;
+    }
+    
+    if (event == FRAME_SUPERVISION) return handle_acknowledgement(conn, ctrl);
+    
+    // Extended UA repeated after a lost SET, or similar
+    if (CTRL_TYPE(ctrl) != CTRL_TYPE_INFO) return 0;
+    
+    // BCC1 covers the piggybacked RR, so it holds even when the data is bad
+    if (frame_has_ack(conn, ctrl) && handle_acknowledgement(conn, conn->parser.ack) < 0) return -1;
+    receive_information(conn, event);
+    return 0;
+}
+
+// Process the next frame or timeout. When not blocking, only what has
+// already arrived is consumed.
+static int service_window(LinkSession *conn, int blocking) {
+    FrameEvent event;
+    do {
+        event = blocking ? receive_frame(conn) : poll_frame(conn);
+        if (event != FRAME_NONE && dispatch_frame(conn, event) < 0) return -1;
+    } while (!blocking && event != FRAME_NONE);
+    
+    return handle_timeout(conn);
+}
+
+// Wait until every queued frame has been acknowledged
+static int flush_window(LinkSession *conn) {
+    if (conn->link_failed) return -1;
+    while (frames_in_flight(conn) > 0) {
+        if (service_window(conn, TRUE) < 0) return -1;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////
+// Connection setup
+////////////////////////////////////////////////
+// Plain SET unless there is something to negotiate, so legacy receivers still work
+static int build_set_frame(LinkSession *conn, const LinkOptions *options, unsigned char *frame) {
+    if (!needs_negotiation(options)) return build_supervision_frame(conn, ADDR_SENDER, CTRL_SET, frame);
+    
+    unsigned char params[MAX_PARAMS_SIZE];
+    int params_len = encode_link_params(options, params);
+    return build_information_frame(conn, ADDR_SENDER, CTRL_SET, params, params_len, frame);
+}
+
+// Send a SET until a UA answers, up to max_retries times; the first wait is
+// extra_ms longer. Returns the UA's frame event, FRAME_NONE if none came, or
+// -1 if the port could not be written.
+static int exchange_set(LinkSession *conn, const unsigned char *set_frame, int set_size,
+                        int extra_ms) {
+    for (int attempt = 0; attempt < conn->max_retries; attempt++) {
+        if (write_all(conn->fd, set_frame, set_size) != set_size) {
+            return -1;
+        }
+        note_written(conn, set_size);
+        long sent_us = departure_us(conn);
+        
+        arm_timer_after(conn, sent_us, conn->rto_ms + (attempt == 0 ? extra_ms : 0));
+        
+        FrameEvent event;
+        while ((event = receive_frame(conn)) != FRAME_NONE) {
+            if (event == FRAME_BAD_DATA || conn->parser.ctrl != CTRL_UA) continue;
+            disarm_timer(conn);
+            
+            // The handshake gives the first RTT estimate
+            long sample_us = now_us() - sent_us;
+            if (attempt == 0 && conn->rtt_samples == 0) update_rtt(conn, sample_us > 0 ? sample_us : 0);
+            return event;
+        }
+        
+        conn->retry_count++;
+        back_off_rto(conn);
+        printf("Timeout - retry %d/%d\n", attempt + 1, conn->max_retries);
+    }
+    
+    return FRAME_NONE;
+}
+
+// Take on the parameters a UA carries; a plain UA means the receiver only
+// speaks stop-and-wait
+static int accept_ua(LinkSession *conn, FrameEvent event, LinkOptions *agreed) {
+    memset(agreed, 0, sizeof(*agreed));
+    if (event == FRAME_INFO) {
+        decode_link_params(conn->parser.data, conn->parser.length, agreed);
+    }
+    normalize_link_options(agreed);
+    return apply_link_options(conn, agreed);
+}
+
+static int setup_connection_transmitter(LinkSession *conn, const LinkOptions *options) {
+    unsigned char set_frame[MAX_PARAMS_SIZE * 2 + 10];
+    int set_size = build_set_frame(conn, options, set_frame);
+    int event = exchange_set(conn, set_frame, set_size, 0);
+    if (event < FRAME_NONE) return -1;
+    
+    LinkOptions agreed;
+    if (event != FRAME_NONE) {
+        if (accept_ua(conn, event, &agreed) < 0) return -1;
+        if (agreed.maxBaudRate <= conn->baud_rate) return 0;
+        
+        // The receiver has moved to the new rate; the same SET confirms it there
+        if (switch_baud_rate(conn, agreed.maxBaudRate) == 0) {
+            event = exchange_set(conn, set_frame, set_size, 0);
+            if (event != FRAME_NONE) return event < 0 ? -1 : 0;
+            printf("No answer at %d baud\n", conn->baud_rate);
+            fall_back_baud_rate(conn);
+        }
+    } else if (options->maxBaudRate > conn->baud_rate) {
+        // A UA offering the rate may have been lost after the receiver
+        // moved to it, and then it cannot read these SETs
+        printf("No answer after offering %d baud\n", options->maxBaudRate);
+    } else {
+        return -1;
+    }
+    
+    // Try again at the opening rate, without asking for more, once the
+    // receiver has given up on the new one
+    usleep(BAUD_FALLBACK_MS * 1000L);
+    tcflush(conn->fd, TCIFLUSH);
+    LinkOptions plain = *options;
+    plain.maxBaudRate = 0;
+    set_size = build_set_frame(conn, &plain, set_frame);
+    event = exchange_set(conn, set_frame, set_size, 0);
+    if (event <= FRAME_NONE) return -1;
+    return accept_ua(conn, event, &agreed);
+}
+
+// UA answering the SET with the parameters in force, kept in ua_frame.
+// max_baud_rate is the rate it tells the transmitter to switch to, 0 for none.
+static void build_ua_frame(LinkSession *conn, int max_baud_rate) {
+    if (!conn->ua_extended) {
+        conn->ua_size = build_supervision_frame(conn, ADDR_RECEIVER, CTRL_UA, conn->ua_frame);
+        return;
+    }
+    
+    LinkOptions agreed;
+    llsession_getoptions(conn, &agreed);
+    agreed.maxBaudRate = max_baud_rate;
+    unsigned char params[MAX_PARAMS_SIZE];
+    int params_len = encode_link_params(&agreed, params);
+    conn->ua_size = build_information_frame(conn, ADDR_RECEIVER, CTRL_UA, params,
+                                            params_len, conn->ua_frame);
+}
+
+static int setup_connection_receiver(LinkSession *conn, const LinkOptions *options) {
+    FrameEvent event;
+    do {
+        event = receive_frame(conn);
+    } while (event == FRAME_BAD_DATA || conn->parser.ctrl != CTRL_SET);
+    
+    LinkOptions agreed = {0};
+    if (event == FRAME_INFO) {
+        decode_link_params(conn->parser.data, conn->parser.length, &agreed);
+    }
+    // Never accept frames larger than this side is prepared to buffer
+    if (options->maxPayload > 0 && agreed.maxPayload > options->maxPayload) {
+        agreed.maxPayload = options->maxPayload;
+    }
+    // Duplex only if this side has something to send as well
+    agreed.duplex = agreed.duplex && options->duplex;
+    // No faster than this side's port goes, and only if it offers a rate too
+    if (agreed.maxBaudRate > options->maxBaudRate) agreed.maxBaudRate = options->maxBaudRate;
+    normalize_link_options(&agreed);
+    if (apply_link_options(conn, &agreed) < 0) return -1;
+    
+    // Answer in kind, and keep the UA in case the SET is repeated
+    conn->ua_extended = event == FRAME_INFO;
+    build_ua_frame(conn, agreed.maxBaudRate);
+    
+    if (write_all(conn->fd, conn->ua_frame, conn->ua_size) != conn->ua_size) return -1;
+    note_written(conn, conn->ua_size);
+    
+    // The transmitter confirms with a SET at the new rate, answered like a
+    // repeated one. Should the port refuse the rate, that SET never gets
+    // through and the transmitter falls back to this one.
+    if (agreed.maxBaudRate > conn->baud_rate) switch_baud_rate(conn, agreed.maxBaudRate);
+    return 0;
+}
+
+////////////////////////////////////////////////
+// Statistics
+////////////////////////////////////////////////
+
+// Stop-and-wait efficiency (1 - FER) / (1 + 2a), a = Tprop / Tf, for the
+// I-frames this side sent (LlTx) or received (LlRx). Tf comes from their
+// average size at 10 bits per byte, Tprop from half the smoothed RTT (whose
+// samples already leave out Tf), and FER from the copies that were resent
+// or arrived damaged. Like the measured figure, only the payload counts.
+static double theoretical_efficiency(LinkSession *conn) {
+    long frames, accepted, wire_bytes, payload_bytes;
+    if (conn->role == LlTx) {
+        accepted = conn->frames_sent;
+        frames = accepted + conn->retransmissions;
+        wire_bytes = conn->wire_bytes_sent;
+        payload_bytes = conn->bytes_sent;
+    } else {
+        accepted = conn->frames_received;
+        frames = accepted + conn->duplicates + conn->bcc1_errors + conn->bcc2_errors;
+        wire_bytes = conn->wire_bytes_received;
+        payload_bytes = conn->bytes_received;
+    }
+    if (accepted == 0 || wire_bytes == 0) return 0;
+    
+    double frame_size = (double)wire_bytes / frames;
+    double payload_share = (double)payload_bytes / accepted / frame_size;
+    double frame_s = frame_size * 10 / conn->baud_rate;
+    double a = conn->srtt_us / 2e6 / frame_s;
+    double fer = (double)(frames - accepted) / frames;
+    return payload_share * (1 - fer) / (1 + 2 * a);
+}
+
+static void print_statistics(LinkSession *conn, const LinkStatistics *stats, int result) {
+    printf("\n=== Connection Statistics (%s) ===\n", conn->serial_port);
+    printf("Role: %s\n", conn->role == LlTx ? "Transmitter" : "Receiver");
+    printf("ARQ: %s (window %d)\n", arq_mode_name(conn->arq_mode),
+           conn->window_size);
+    printf("Frame check: %s\n", fcs_mode_name(conn->fcs_mode));
+    printf("Max payload: %d bytes\n", conn->max_payload);
+    printf("Duplex: %s\n", conn->duplex ? "yes" : "no");
+    if (conn->fec_errors > 0) {
+        printf("FEC: %d byte errors per block, %d bytes repaired\n",
+               conn->fec_errors, stats->fecRepaired);
+    }
+    if (conn->role == LlTx || conn->duplex) {
+        printf("I-frames sent: %d (%ld bytes), %d retransmitted\n",
+               stats->framesSent, stats->bytesSent, stats->retransmissions);
+        printf("REJ/SREJ received: %d, timeouts: %d\n", stats->rejects, stats->timeouts);
+        printf("Bytes on the wire: %ld (%ld added by stuffing)\n",
+               stats->wireBytesSent, stats->stuffingBytes);
+        if (conn->rtt_samples > 0) {
+            printf("RTT: %.1f ms (+/- %.1f ms), timeout %d ms\n",
+                   conn->srtt_us / 1000.0, conn->rttvar_us / 1000.0,
+                   conn->rto_ms);
+        }
+    }
+    if (conn->role == LlRx || conn->duplex) {
+        printf("I-frames received: %d (%ld bytes), %d duplicates\n",
+               stats->framesReceived, stats->bytesReceived, stats->duplicates);
+        printf("BCC1 errors: %d, BCC2 errors: %d, REJ/SREJ sent: %d\n",
+               stats->bcc1Errors, stats->bcc2Errors, stats->rejectsSent);
+    }
+    printf("Time: %.3f s, goodput %.0f bit/s\n", stats->elapsedMs / 1000.0, stats->goodputBps);
+    printf("Efficiency: %.3f (stop-and-wait theory %.3f)\n",
+           stats->efficiency, stats->theoreticalEfficiency);
+    printf("Status: %s\n", result == 0 ? "Success" : "Failed");
+}
+
+// One exported value, already formatted
+typedef struct {
+    const char *name;
+    char value[64];
+    int quoted; // A string rather than a number in JSON
+} StatField;
+
+#define MAX_STAT_FIELDS 40
+
+static void add_field(StatField *fields, int *count, const char *name, int quoted,
+                      const char *format, ...) {
+    StatField *field = &fields[(*count)++];
+    field->name = name;
+    field->quoted = quoted;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(field->value, sizeof(field->value), format, args);
+    va_end(args);
+}
+
+// The settings and counters of a run, in the order of the CSV columns
+static int collect_fields(LinkSession *conn, const LinkStatistics *stats, int result,
+                          StatField *fields) {
+    int n = 0;
+    add_field(fields, &n, "time", FALSE, "%ld", (long)time(NULL));
+    add_field(fields, &n, "port", TRUE, "%s", conn->serial_port);
+    add_field(fields, &n, "role", TRUE, "%s", conn->role == LlTx ? "tx" : "rx");
+    add_field(fields, &n, "status", TRUE, "%s", result == 0 ? "success" : "failed");
+    add_field(fields, &n, "baud_rate", FALSE, "%d", conn->baud_rate);
+    add_field(fields, &n, "arq", TRUE, "%s", arq_mode_name(conn->arq_mode));
+    add_field(fields, &n, "window", FALSE, "%d", conn->window_size);
+    add_field(fields, &n, "fcs", TRUE, "%s", fcs_mode_name(conn->fcs_mode));
+    add_field(fields, &n, "max_payload", FALSE, "%d", conn->max_payload);
+    add_field(fields, &n, "duplex", FALSE, "%d", conn->duplex);
+    add_field(fields, &n, "fec_errors", FALSE, "%d", conn->fec_errors);
+    add_field(fields, &n, "elapsed_ms", FALSE, "%d", stats->elapsedMs);
+    add_field(fields, &n, "frames_sent", FALSE, "%d", stats->framesSent);
+    add_field(fields, &n, "bytes_sent", FALSE, "%ld", stats->bytesSent);
+    add_field(fields, &n, "retransmissions", FALSE, "%d", stats->retransmissions);
+    add_field(fields, &n, "rejects_received", FALSE, "%d", stats->rejects);
+    add_field(fields, &n, "timeouts", FALSE, "%d", stats->timeouts);
+    add_field(fields, &n, "wire_bytes_sent", FALSE, "%ld", stats->wireBytesSent);
+    add_field(fields, &n, "stuffing_bytes", FALSE, "%ld", stats->stuffingBytes);
+    add_field(fields, &n, "rtt_ms", FALSE, "%d", stats->rttMs);
+    add_field(fields, &n, "frames_received", FALSE, "%d", stats->framesReceived);
+    add_field(fields, &n, "bytes_received", FALSE, "%ld", stats->bytesReceived);
+    add_field(fields, &n, "wire_bytes_received", FALSE, "%ld", stats->wireBytesReceived);
+    add_field(fields, &n, "rejects_sent", FALSE, "%d", stats->rejectsSent);
+    add_field(fields, &n, "duplicates", FALSE, "%d", stats->duplicates);
+    add_field(fields, &n, "bcc1_errors", FALSE, "%d", stats->bcc1Errors);
+    add_field(fields, &n, "bcc2_errors", FALSE, "%d", stats->bcc2Errors);
+    add_field(fields, &n, "fec_repaired", FALSE, "%d", stats->fecRepaired);
+    add_field(fields, &n, "goodput_bps", FALSE, "%.1f", stats->goodputBps);
+    add_field(fields, &n, "efficiency", FALSE, "%.4f", stats->efficiency);
+    add_field(fields, &n, "theoretical_efficiency", FALSE, "%.4f", stats->theoreticalEfficiency);
+    return n;
+}
+
+// Append one record to path: a JSON object on a line of its own, or a CSV
+// row with a header line first when the file is new
+static void append_statistics(const char *path, const StatField *fields, int count, int csv) {
+    FILE *file = fopen(path, "a");
+    if (file == NULL) {
+        perror(path);
+        return;
+    }
+    
+    // Bonded links close at the same time and append to the same files
+    flock(fileno(file), LOCK_EX);
+    fseek(file, 0, SEEK_END);
+    
+    if (csv) {
+        if (ftell(file) == 0) {
+            for (int i = 0; i < count; i++) {
+                fprintf(file, "%s%s", i > 0 ? "," : "", fields[i].name);
+            }
+            fprintf(file, "\n");
+        }
+        for (int i = 0; i < count; i++) {
+            fprintf(file, "%s%s", i > 0 ? "," : "", fields[i].value);
+        }
+    } else {
+        fprintf(file, "{");
+        for (int i = 0; i < count; i++) {
+            fprintf(file, "%s\"%s\": %s%s%s", i > 0 ? ", " : "", fields[i].name,
+                    fields[i].quoted ? "\"" : "", fields[i].value,
+                    fields[i].quoted ? "\"" : "");
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n");
+    
+    fflush(file);
+    flock(fileno(file), LOCK_UN);
+    fclose(file);
+}
+
+static void export_statistics(LinkSession *conn, const LinkStatistics *stats, int result) {
+    if (conn->stats_json == NULL && conn->stats_csv == NULL) return;
+    
+    StatField fields[MAX_STAT_FIELDS];
+    int count = collect_fields(conn, stats, result, fields);
+    if (conn->stats_json != NULL) append_statistics(conn->stats_json, fields, count, FALSE);
+    if (conn->stats_csv != NULL) append_statistics(conn->stats_csv, fields, count, TRUE);
+}
+
+////////////////////////////////////////////////
+// Public API
+////////////////////////////////////////////////
+// Release everything a session holds, including the session itself
+static void destroy_session(LinkSession *conn) {
+    release_buffers(conn);
+    if (conn->timer_fd >= 0) close(conn->timer_fd);
+    if (conn->fd >= 0) closeSerialPortFd(conn->fd, &conn->saved_tio);
+    free(conn);
+}
+
+LinkSession *llsession_open(LinkLayer connectionParameters) {
+    // calloc() leaves every counter, flag and buffer pointer cleared
+    LinkSession *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    snprintf(conn->serial_port, sizeof(conn->serial_port), "%s", connectionParameters.serialPort);
+    conn->timer_fd = -1;
+    conn->opened_us = now_us();
+    conn->trace_id = trace_register(conn->serial_port);
+    trace_event(conn->trace_id, TRACE_OPEN_BEGIN, 0, 0);
+    conn->stats_json = connectionParameters.options.statsJson;
+    conn->stats_csv = connectionParameters.options.statsCsv;
+    
+    conn->fd = openSerialPortFd(connectionParameters.serialPort,
+                                connectionParameters.baudRate, &conn->saved_tio);
+    if (conn->fd < 0) {
+        trace_event(conn->trace_id, TRACE_OPEN_END, 0, -1);
+        free(conn);
+        return NULL;
+    }
+    
+    // Flow control is set up the same way on both sides, not negotiated:
+    // the SET itself already has to be escaped for XON/XOFF
+    LinkFlowControl flow = connectionParameters.options.flowControl;
+    conn->escape_flow = flow == LlFlowXonXoff;
+    if (flow != LlFlowNone &&
+        setSerialPortFlowControlFd(conn->fd, flow == LlFlowRtsCts, flow == LlFlowXonXoff) < 0) {
+        trace_event(conn->trace_id, TRACE_OPEN_END, 0, -1);
+        destroy_session(conn);
+        return NULL;
+    }
+    
+    conn->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (conn->timer_fd < 0) {
+        perror("timerfd_create");
+        trace_event(conn->trace_id, TRACE_OPEN_END, 0, -1);
+        destroy_session(conn);
+        return NULL;
+    }
+    
+    conn->role = connectionParameters.role;
+    conn->baud_rate = connectionParameters.baudRate;
+    conn->base_baud_rate = conn->baud_rate;
+    conn->timeout_ms = connectionParameters.options.timeoutMs > 0
+                           ? connectionParameters.options.timeoutMs
+                           : connectionParameters.timeout * 1000;
+    conn->rto_ms = conn->timeout_ms;
+    conn->max_retries = connectionParameters.nRetransmissions;
+    conn->parser.state = WAIT_FLAG;
+    
+    // The transmitter starts from what it proposes, the receiver from the
+    // defaults until the SET arrives
+    LinkOptions options = conn->role == LlTx ? connectionParameters.options : (LinkOptions){0};
+    normalize_link_options(&options);
+    
+    int result = apply_link_options(conn, &options);
+    if (result == 0 && conn->role == LlTx) {
+        result = setup_connection_transmitter(conn, &options);
+    } else if (result == 0) {
+        result = setup_connection_receiver(conn, &connectionParameters.options);
+    }
+    
+    if (result == 0 && conn->arq_mode != LlStopAndWait) {
+        printf("%s with window %d\n", arq_mode_name(conn->arq_mode), conn->window_size);
+    }
+    if (result == 0 && conn->fcs_mode != LlFcsXor) {
+        printf("Frame check: %s\n", fcs_mode_name(conn->fcs_mode));
+    }
+    if (result == 0 && conn->max_payload != MAX_PAYLOAD_SIZE) {
+        printf("Max payload: %d bytes\n", conn->max_payload);
+    }
+    if (result == 0 && conn->duplex) {
+        printf("Full duplex\n");
+    }
+    if (result == 0 && conn->fec_errors > 0) {
+        printf("FEC: up to %d byte errors repaired per block\n", conn->fec_errors);
+    }
+    trace_event(conn->trace_id, TRACE_OPEN_END, 0, result);
+    if (result != 0) {
+        destroy_session(conn);
+        return NULL;
+    }
+    return conn;
+}
+
+int llsession_maxpayload(LinkSession *conn) {
+    return conn->max_payload;
+}
+
+void llsession_getoptions(LinkSession *conn, LinkOptions *options) {
+    options->arqMode = conn->arq_mode;
+    options->windowSize = conn->window_size;
+    options->fcsMode = conn->fcs_mode;
+    options->timeoutMs = conn->timeout_ms;
+    options->maxPayload = conn->max_payload;
+    options->duplex = conn->duplex;
+    options->fecErrors = conn->fec_errors;
+    options->maxBaudRate = conn->baud_rate;
+    options->statsJson = conn->stats_json;
+    options->statsCsv = conn->stats_csv;
+}
+
+void llsession_statistics(LinkSession *conn, LinkStatistics *stats) {
+    stats->framesSent = conn->frames_sent;
+    stats->retransmissions = conn->retransmissions;
+    stats->rejects = conn->rejects;
+    stats->timeouts = conn->timeouts;
+    stats->bytesSent = conn->bytes_sent;
+    stats->wireBytesSent = conn->wire_bytes_sent;
+    stats->stuffingBytes = conn->stuffing_bytes;
+    stats->rttMs = (int)(conn->srtt_us / 1000);
+    stats->framesReceived = conn->frames_received;
+    stats->bytesReceived = conn->bytes_received;
+    stats->wireBytesReceived = conn->wire_bytes_received;
+    stats->rejectsSent = conn->rejects_sent;
+    stats->duplicates = conn->duplicates;
+    stats->bcc1Errors = conn->bcc1_errors;
+    stats->bcc2Errors = conn->bcc2_errors;
+    stats->fecRepaired = conn->fec_repaired;
+    
+    long elapsed_us = now_us() - conn->opened_us;
+    stats->elapsedMs = (int)(elapsed_us / 1000);
+    long payload = conn->role == LlTx ? conn->bytes_sent : conn->bytes_received;
+    stats->goodputBps = elapsed_us > 0 ? payload * 8 * 1e6 / elapsed_us : 0;
+    // An 8N1 line carries 8 data bits for every 10 baud
+    stats->efficiency = stats->goodputBps / (conn->baud_rate * 0.8);
+    stats->theoreticalEfficiency = theoretical_efficiency(conn);
+}
+
+// Queue the frame in the next free slot and send it right away; the window
+// must have room
+static int queue_frame(LinkSession *conn, const unsigned char *buf, int bufSize) {
+    if (bufSize <= 0 || bufSize > conn->max_payload || conn->link_failed) {
+        return -1;
+    }
+    // A full window would wrap the sequence numbers onto unacknowledged frames
+    if (frames_in_flight(conn) >= conn->window_size) return -1;
+    
+    WindowSlot *slot = &conn->tx_window[conn->seq_end % MAX_WINDOW_SIZE];
+    if (prepare_information_frame(conn, slot, info_ctrl(conn, conn->seq_end), buf, bufSize) < 0) {
+        return -1;
+    }
+    slot->retries = 0;
+    slot->transmissions = 0;
+    conn->frames_sent++;
+    conn->bytes_sent += bufSize;
+    printf("Sending frame %d (%d bytes)...\n", conn->seq_end, slot->size);
+    conn->seq_end = seq_add(conn, conn->seq_end, 1);
+    transmit_window(conn);
+    return bufSize;
+}
+
+static int write_frame(LinkSession *conn, const unsigned char *buf, int bufSize) {
+    // llsubmit() may have filled the window: wait for a slot first
+    while (frames_in_flight(conn) >= conn->window_size) {
+        if (conn->link_failed || service_window(conn, TRUE) < 0) return -1;
+    }
+    if (queue_frame(conn, buf, bufSize) < 0) return -1;
+    
+    // Stop-and-wait is a window of one: block until the window has room again
+    while (frames_in_flight(conn) >= conn->window_size) {
+        if (service_window(conn, TRUE) < 0) return -1;
+    }
+    
+    // Pick up acknowledgements that are already waiting
+    if (service_window(conn, FALSE) < 0) return -1;
+    
+    return bufSize;
+}
+
+int llsession_write(LinkSession *conn, const unsigned char *buf, int bufSize) {
+    trace_event(conn->trace_id, TRACE_WRITE_BEGIN, conn->seq_end, bufSize);
+    int result = write_frame(conn, buf, bufSize);
+    trace_event(conn->trace_id, TRACE_WRITE_END, conn->seq_end, result);
+    return result;
+}
+
+int llsession_submit(LinkSession *conn, const unsigned char *buf, int bufSize) {
+    // Acknowledgements already waiting may free a slot
+    if (conn->link_failed || service_window(conn, FALSE) < 0) return -1;
+    if (frames_in_flight(conn) >= conn->window_size) return 0;
+    
+    trace_event(conn->trace_id, TRACE_WRITE_BEGIN, conn->seq_end, bufSize);
+    int result = queue_frame(conn, buf, bufSize);
+    trace_event(conn->trace_id, TRACE_WRITE_END, conn->seq_end, result);
+    return result;
+}
+
+static void fill_link_events(LinkSession *conn, LinkEvents *events) {
+    events->acknowledged = (int)(conn->frames_acked - conn->acked_reported);
+    events->readable = conn->inbox_count;
+    events->writable = frames_in_flight(conn) < conn->window_size;
+    events->disconnected = conn->disc_received;
+}
+
+int llsession_poll(LinkSession *conn, int timeoutMs, LinkEvents *events) {
+    long deadline_us = now_us() + timeoutMs * 1000L;
+    
+    while (1) {
+        if (conn->link_failed || service_window(conn, FALSE) < 0) return -1;
+        
+        fill_link_events(conn, events);
+        if (events->acknowledged > 0 || events->readable > 0 || events->disconnected) break;
+        
+        if (timeoutMs == 0) break;
+        int wait_ms = -1;
+        if (timeoutMs > 0) {
+            long left_us = deadline_us - now_us();
+            if (left_us <= 0) break;
+            wait_ms = (int)((left_us + 999) / 1000);
+        }
+        
+        int watchdog_ms = baud_watchdog_ms(conn);
+        if (watchdog_ms >= 0 && (wait_ms < 0 || watchdog_ms < wait_ms)) wait_ms = watchdog_ms;
+        
+        // About to wait: an RR held back for piggybacking goes out now
+        flush_acknowledgement(conn);
+        if (wait_for_input(conn, TRUE, wait_ms) && fill_rx_ring(conn) <= 0) {
+            // Cable unplugged (EIO/hangup): back off, but still watch the timer
+            wait_for_input(conn, FALSE, 50);
+        }
+    }
+    
+    conn->acked_reported = conn->frames_acked;
+    return 0;
+}
+
+int llsession_pending(LinkSession *conn) {
+    if (conn->duplex && service_window(conn, FALSE) < 0) return -1;
+    return conn->inbox_count;
+}
+
+static int read_frame(LinkSession *conn, unsigned char *packet) {
+    // Frames accepted meanwhile (reordered, or received during llwrite()) go first
+    while (conn->inbox_count == 0) {
+        if (conn->disc_received) return 0; // Signal disconnection
+        if (service_window(conn, TRUE) < 0) return -1;
+    }
+    
+    InboxSlot *slot = &conn->inbox[conn->inbox_head];
+    int length = slot->length;
+    memcpy(packet, slot->data, length);
+    conn->inbox_head = (conn->inbox_head + 1) % INBOX_SIZE;
+    conn->inbox_count--;
+    
+    // Frames held back while the inbox was full can be taken now
+    if (drain_reorder_buffer(conn) > 0) acknowledge(conn);
+    return length;
+}
+
+int llsession_read(LinkSession *conn, unsigned char *packet) {
+    trace_event(conn->trace_id, TRACE_READ_BEGIN, conn->seq_expected, 0);
+    int result = read_frame(conn, packet);
+    trace_event(conn->trace_id, TRACE_READ_END, conn->seq_expected, result);
+    return result;
+}
+
+int llsession_close(LinkSession *conn, int showStatistics) {
     int result = -1;
+    trace_event(conn->trace_id, TRACE_CLOSE_BEGIN, 0, 0);
     
-    if (conn_state.role == LlTx) {
+    // Settle what we owe the peer, then everything still in our window must
+    // be acknowledged
+    flush_acknowledgement(conn);
+    if (flush_window(conn) < 0) {
+        printf("Some frames were never acknowledged\n");
+    }
+    
+    if (conn->role == LlTx) {
         // Transmitter initiates disconnection
-        configure_alarm_handler();
-        
-        for (conn_state.retry_count = 0; 
-             conn_state.retry_count < conn_state.max_retries; 
-             conn_state.retry_count++) {
+        for (conn->retry_count = 0; 
+             conn->retry_count < conn->max_retries; 
+             conn->retry_count++) {
             
             printf("Sending DISC (attempt %d/%d)...\n", 
-                   conn_state.retry_count + 1, conn_state.max_retries);
+                   conn->retry_count + 1, conn->max_retries);
             
-            if (transmit_supervision_frame(conn_state.fd, ADDR_SENDER, CTRL_DISC) < 0) {
+            if (transmit_supervision_frame(conn, ADDR_SENDER, CTRL_DISC) < 0) {
                 continue;
             }
             
             // Wait for DISC response
-            conn_state.alarm_triggered = 0;
-            alarm(conn_state.timeout_duration);
-            
-            unsigned char response[5];
-            int idx = 0;
-            int got_disc = 0;
-            
-            while (!conn_state.alarm_triggered && idx < 5) {
-                unsigned char byte;
-                if (read(conn_state.fd, &byte, 1) == 1) {
-                    response[idx++] = byte;
-                    
-                    if (idx == 5 && response[4] == FRAME_FLAG) {
-                        unsigned char ctrl = response[2];
-                        unsigned char bcc = response[3];
-                        
-                        if (bcc == (response[1] ^ ctrl) && ctrl == CTRL_DISC) {
-                            got_disc = 1;
-                            break;
-                        }
-                    }
-                    
-                    if (byte == FRAME_FLAG && idx < 5) {
-                        response[0] = byte;
-                        idx = 1;
-                    }
-                }
-            }
-            
-            alarm(0);
+            arm_reply_timer(conn, conn->rto_ms);
+            int got_disc = receive_supervision_frame(conn, CTRL_DISC) == 0;
+            disarm_timer(conn);
+            if (!got_disc) back_off_rto(conn);
             
             if (got_disc) {
                 printf("Received DISC, sending UA...\n");
-                transmit_supervision_frame(conn_state.fd, ADDR_SENDER, CTRL_UA);
+                transmit_supervision_frame(conn, ADDR_SENDER, CTRL_UA);
                 sleep(1); // Give receiver time to process
                 result = 0;
                 break;
@@ -637,62 +2093,102 @@ int llclose(int showStatistics) {
         // Receiver waits for DISC
         printf("Waiting for DISC...\n");
         
-        unsigned char response[5];
-        int idx = 0;
+        // Frames still arriving are acknowledged as usual, for as long as
+        // the transmitter would keep trying
+        long deadline_us = now_us() + (long)conn->rto_ms * conn->max_retries * 1000;
+        while (!conn->disc_received && !conn->link_failed) {
+            long left_us = deadline_us - now_us();
+            if (left_us <= 0) break;
+            arm_timer(conn, (int)((left_us + 999) / 1000));
+            if (service_window(conn, TRUE) < 0) break;
+        }
+        disarm_timer(conn);
         
-        while (idx < 5) {
-            unsigned char byte;
-            if (read(conn_state.fd, &byte, 1) == 1) {
-                response[idx++] = byte;
-                
-                if (idx == 5 && response[4] == FRAME_FLAG) {
-                    unsigned char ctrl = response[2];
-                    unsigned char bcc = response[3];
-                    
-                    if (bcc == (response[1] ^ ctrl) && ctrl == CTRL_DISC) {
-                        printf("Received DISC, sending DISC...\n");
-                        transmit_supervision_frame(conn_state.fd, ADDR_RECEIVER, CTRL_DISC);
-                        
-                        // Wait for UA
-                        idx = 0;
-                        while (idx < 5) {
-                            if (read(conn_state.fd, &byte, 1) == 1) {
-                                response[idx++] = byte;
-                                
-                                if (idx == 5 && response[4] == FRAME_FLAG) {
-                                    ctrl = response[2];
-                                    if (ctrl == CTRL_UA) {
-                                        printf("Received UA\n");
-                                        result = 0;
-                                    }
-                                    break;
-                                }
-                                
-                                if (byte == FRAME_FLAG && idx < 5) {
-                                    response[0] = byte;
-                                    idx = 1;
-                                }
-                            }
-                        }
-                        break;
-                    }
-                }
-                
-                if (byte == FRAME_FLAG && idx < 5) {
-                    response[0] = byte;
-                    idx = 1;
-                }
+        if (!conn->disc_received) {
+            printf("No DISC from the transmitter\n");
+        }
+        
+        for (conn->retry_count = 0;
+             conn->disc_received && conn->retry_count < conn->max_retries;
+             conn->retry_count++) {
+            printf("Received DISC, sending DISC...\n");
+            transmit_supervision_frame(conn, ADDR_RECEIVER, CTRL_DISC);
+            
+            // Wait for UA
+            arm_reply_timer(conn, conn->rto_ms);
+            int got_ua = receive_supervision_frame(conn, CTRL_UA) == 0;
+            disarm_timer(conn);
+            if (!got_ua) back_off_rto(conn);
+            
+            if (got_ua) {
+                printf("Received UA\n");
+                result = 0;
+                break;
             }
         }
     }
     
-    if (showStatistics) {
-        printf("\n=== Connection Statistics ===\n");
-        printf("Role: %s\n", conn_state.role == LlTx ? "Transmitter" : "Receiver");
-        printf("Total retries: %d\n", conn_state.retry_count);
-        printf("Status: %s\n", result == 0 ? "Success" : "Failed");
-    }
+    LinkStatistics stats;
+    llsession_statistics(conn, &stats);
+    if (showStatistics) print_statistics(conn, &stats, result);
+    export_statistics(conn, &stats, result);
     
-    closeSerialPort(conn_state.fd);
+    trace_event(conn->trace_id, TRACE_CLOSE_END, 0, result);
+    destroy_session(conn);
+    return result;
+}
+
+////////////////////////////////////////////////
+// Single-link API
+////////////////////////////////////////////////
+
+// The original calls drive one link per process through this session
+static LinkSession *default_session = NULL;
+
+int llopen(LinkLayer connectionParameters) {
+    // One link at a time; further ports need sessions of their own
+    if (default_session != NULL) {
+        printf("A connection is already open, llclose() it first\n");
+        return -1;
+    }
+    default_session = llsession_open(connectionParameters);
+    return default_session != NULL ? default_session->fd : -1;
+}
+
+int llmaxpayload(void) {
+    return llsession_maxpayload(default_session);
+}
+
+void llgetoptions(LinkOptions *options) {
+    llsession_getoptions(default_session, options);
+}
+
+void llstatistics(LinkStatistics *stats) {
+    llsession_statistics(default_session, stats);
+}
+
+int llwrite(const unsigned char *buf, int bufSize) {
+    return llsession_write(default_session, buf, bufSize);
+}
+
+int llsubmit(const unsigned char *buf, int bufSize) {
+    return llsession_submit(default_session, buf, bufSize);
+}
+
+int llpoll(int timeoutMs, LinkEvents *events) {
+    return llsession_poll(default_session, timeoutMs, events);
+}
+
+int llpending(void) {
+    return llsession_pending(default_session);
+}
+
+int llread(unsigned char *packet) {
+    return llsession_read(default_session, packet);
+}
+
+int llclose(int showStatistics) {
+    int result = llsession_close(default_session, showStatistics);
+    default_session = NULL;
     return result;
 }
@@ -10,37 +10,200 @@ typedef enum
     LlRx,
 } LinkLayerRole;
 
+// Retransmission strategy used for I-frames.
+typedef enum
+{
+    LlStopAndWait,     // One frame in flight, sequence numbers modulo 2
+    LlGoBackN,         // Up to windowSize frames in flight, cumulative RR, REJ rewinds
+    LlSelectiveRepeat, // As Go-Back-N, but the receiver reorders and SREJ resends one frame
+} LinkArqMode;
+
+// Frame check sequence protecting the data field of I-frames.
+typedef enum
+{
+    LlFcsXor,    // Original one-byte BCC2 (XOR of the data bytes)
+    LlFcsCrc16,  // CRC-16-CCITT (HDLC/X.25), 2 bytes
+    LlFcsCrc32c, // CRC-32C (Castagnoli), 4 bytes
+} LinkFcsMode;
+
+// Flow control on the serial port, so a busy receiver holds the sender back
+// instead of losing bytes.
+typedef enum
+{
+    LlFlowNone,
+    LlFlowRtsCts,  // Hardware, on the RTS/CTS lines
+    LlFlowXonXoff, // Software; frames then escape XON/XOFF, headers included
+} LinkFlowControl;
+
+// Optional link settings. A zeroed struct selects the plain stop-and-wait
+// protocol. The ARQ mode, window, frame check, payload size, duplex mode and
+// FEC strength are proposed by the transmitter in the SET frame; the others
+// are local to each side.
+typedef struct
+{
+    LinkArqMode arqMode;
+    int windowSize;
+    LinkFcsMode fcsMode;
+    int timeoutMs; // Initial retransmission timeout; overrides LinkLayer.timeout when > 0
+    // Largest payload per frame: proposed by the transmitter (0 for MAX_PAYLOAD_SIZE),
+    // and the most the receiver accepts (0 for MAX_PAYLOAD_LIMIT)
+    int maxPayload;
+    // Both sides may call llwrite() and llread(); acknowledgements ride on
+    // I-frames going the other way. The receiver accepts it only if it sets it too.
+    int duplex;
+    // Reed-Solomon FEC on I-frame data fields: byte errors repaired per block
+    // of up to 255 bytes without a retransmission (0 disables, at most
+    // MAX_FEC_ERRORS). Each block then carries twice as many check bytes.
+    int fecErrors;
+    // Files llclose() appends this side's statistics to, one JSON object per
+    // line and one CSV row (after a header line when the file is new). NULL
+    // for none.
+    const char *statsJson;
+    const char *statsCsv;
+    // Must be the same on both sides (and on the cable).
+    LinkFlowControl flowControl;
+    // Fastest baud rate this side's port supports. When both sides give one
+    // above LinkLayer.baudRate, the link opens at that rate and then moves to
+    // the lower of the two. It returns to the opening rate if a quarter of the
+    // last 32 frames sent there needed a resend, or one frame ran out of
+    // retries. 0 stays at the opening rate.
+    int maxBaudRate;
+} LinkOptions;
+
 typedef struct
 {
     char serialPort[50];
     LinkLayerRole role;
     int baudRate;
     int nRetransmissions;
-    int timeout;
+    int timeout; // Seconds
+    LinkOptions options;
 } LinkLayer;
 
+// Counters kept by the link layer since llopen().
+typedef struct
+{
+    // Sending
+    int framesSent;       // I-frames passed to llwrite()
+    int retransmissions;  // I-frames sent again
+    int rejects;          // REJ and SREJ received
+    int timeouts;         // Retransmission timer expiries
+    long bytesSent;       // Payload bytes passed to llwrite()
+    long wireBytesSent;   // I-frame bytes put on the wire, resent ones included
+    long stuffingBytes;   // Escape bytes byte stuffing added to those
+    int rttMs;            // Smoothed round-trip time, 0 until measured
+    // Receiving
+    int framesReceived;   // I-frames accepted, each counted once
+    long bytesReceived;   // Payload bytes of those
+    long wireBytesReceived; // Every byte read from the port
+    int rejectsSent;      // REJ and SREJ sent
+    int duplicates;       // I-frames received again after being accepted
+    int bcc1Errors;       // Frames dropped for a bad header
+    int bcc2Errors;       // I-frames dropped for a bad data field
+    int fecRepaired;      // Bytes repaired by FEC in I-frames received
+    // Connection
+    int elapsedMs;        // Wall time since llopen()
+    // Payload bits per second in the direction of the role (sent by LlTx,
+    // received by LlRx) and its share of the line capacity
+    double goodputBps;
+    double efficiency;
+    // What stop-and-wait should achieve over this link: (1 - FER) / (1 + 2a)
+    // from the observed frame error rate, frame time and round-trip time,
+    // scaled by the payload share of each frame
+    double theoreticalEfficiency;
+} LinkStatistics;
+
+// What llpoll() found ready.
+typedef struct
+{
+    int acknowledged; // Frames from llsubmit()/llwrite() acknowledged since the last llpoll()
+    int readable;     // Packets llread() returns without blocking
+    int writable;     // llsubmit() accepts another frame
+    int disconnected; // The peer sent DISC; llread() returns 0 once readable runs out
+} LinkEvents;
+
 // Size of maximum acceptable payload.
-// Maximum number of bytes that application layer should send to link layer.
+// Maximum number of bytes that application layer should send to link layer,
+// unless a larger payload was negotiated (see llmaxpayload()).
 #define MAX_PAYLOAD_SIZE 1000
 
+// Largest payload that can be negotiated in SET/UA.
+#define MAX_PAYLOAD_LIMIT 65536
+
+// Largest sliding window supported (sequence numbers are taken modulo 16).
+#define MAX_WINDOW_SIZE 8
+
+// Most byte errors per block the FEC can be asked to repair.
+#define MAX_FEC_ERRORS 16
+
 // MISC
 #define FALSE 0
 #define TRUE 1
 
 // Open a connection using the "port" parameters defined in struct linkLayer.
-// Return 0 on success or -1 on error.
+// Return 0 on success or -1 on error, also if one is already open.
 int llopen(LinkLayer connectionParameters);
 
+// The ll* functions drive a single link per process. Each session below is
+// an independent link with all of its state behind the handle, so one
+// process can serve many ports, one thread per session. A session must not
+// be used by two threads at once.
+typedef struct LinkSession LinkSession;
+
+// Session variants of llopen() and the calls below. llsession_open() returns
+// NULL on error; llsession_close() frees the session.
+LinkSession *llsession_open(LinkLayer connectionParameters);
+int llsession_maxpayload(LinkSession *session);
+void llsession_getoptions(LinkSession *session, LinkOptions *options);
+void llsession_statistics(LinkSession *session, LinkStatistics *stats);
+int llsession_write(LinkSession *session, const unsigned char *buf, int bufSize);
+int llsession_submit(LinkSession *session, const unsigned char *buf, int bufSize);
+int llsession_poll(LinkSession *session, int timeoutMs, LinkEvents *events);
+int llsession_pending(LinkSession *session);
+int llsession_read(LinkSession *session, unsigned char *packet);
+int llsession_close(LinkSession *session, int showStatistics);
+
+// Largest payload the open connection carries: llwrite() accepts up to this
+// many bytes, and llread() may return as many.
+int llmaxpayload(void);
+
+// Copy the options agreed in llopen() into options.
+void llgetoptions(LinkOptions *options);
+
+// Copy the link counters into stats.
+void llstatistics(LinkStatistics *stats);
+
 // Send data in buf with size bufSize.
+// With a sliding window the call returns as soon as the frame is queued and
+// the window has room for another one; llclose() waits for the rest.
 // Return number of chars written, or -1 on error.
 int llwrite(const unsigned char *buf, int bufSize);
 
-// Receive data in packet.
+// Send data in buf with size bufSize without waiting: the frame goes out if
+// the window has room, and buf can be reused right away. llpoll() reports
+// when it is acknowledged; llclose() waits for whatever is left.
+// Return bufSize if sent, 0 if the window is full, or -1 on error.
+int llsubmit(const unsigned char *buf, int bufSize);
+
+// Drive the link: take in whatever arrived, acknowledge I-frames, resend on
+// timeouts, and fill events. Waits up to timeoutMs (0 not at all, -1 with no
+// limit) for a frame to be acknowledged, a packet to become readable or the
+// peer to disconnect.
+// Return 0, or -1 if the link failed.
+int llpoll(int timeoutMs, LinkEvents *events);
+
+// Number of received packets llread() can return without blocking. On a
+// duplex link this also processes whatever has arrived meanwhile.
+// Return -1 if the link failed.
+int llpending(void);
+
+// Receive data in packet, which must hold llmaxpayload() bytes.
 // Return number of chars read, or -1 on error.
 int llread(unsigned char *packet);
 
 // Close previously opened connection and print transmission statistics in the console.
+// The statistics also go to the files named in LinkOptions, shown or not.
 // Return 0 on success or -1 on error.
-int llclose();
+int llclose(int showStatistics);
 
 #endif // _LINK_LAYER_H_
@@ -6,6 +6,8 @@
 #include <string.h>
 
 #include "application_layer.h"
+#include "serial_speed.h"
+#include "trace.h"
 
 #define N_TRIES 3
 #define TIMEOUT 4
@@ -15,11 +17,24 @@
 //   $2: baud rate
 //   $3: tx | rx
 //   $4: filename
+//   [--arq sw|gbn|sr] [--window n] [--fcs xor|crc16|crc32c]:
+//       optional link settings (proposed by tx)
+//   [--fec n]: repair up to n byte errors per 255-byte block (proposed by tx)
+//   [--flow none|rtscts|xonxoff]: serial port flow control (both sides)
+//   [--max-baud n]: move to the fastest rate up to n both sides support (both sides)
+//   [--compress]: compress the data packets (tx)
+//   [--bond /dev/ttySyy]...: stripe the file across further ports
+//   [--stats-json file] [--stats-csv file]: append the link statistics on close
+//   [--trace file]: record link events and dump them to file at the end
 int main(int argc, char *argv[])
 {
     if (argc < 5)
     {
-        printf("Usage: %s /dev/ttySxx baudrate tx|rx filename\n", argv[0]);
+        printf("Usage: %s /dev/ttySxx baudrate tx|rx filename [--arq sw|gbn|sr] [--window n]\n"
+               "       [--fcs xor|crc16|crc32c] [--timeout-ms n] [--max-payload n] [--duplex file]\n"
+               "       [--fec n] [--flow none|rtscts|xonxoff] [--max-baud n] [--compress]\n"
+               "       [--bond /dev/ttySyy]... [--stats-json file] [--stats-csv file] [--trace file]\n",
+               argv[0]);
         exit(1);
     }
 
@@ -29,20 +44,9 @@ int main(int argc, char *argv[])
     const char *filename = argv[4];
 
     // Validate baud rate
-    switch (baudrate)
+    if (baudrate < MIN_BAUD_RATE || baudrate > MAX_BAUD_RATE)
     {
-    case 1200:
-    case 1800:
-    case 2400:
-    case 4800:
-    case 9600:
-    case 19200:
-    case 38400:
-    case 57600:
-    case 115200:
-        break;
-    default:
-        printf("Unsupported baud rate (must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200)\n");
+        printf("Unsupported baud rate (must be between %d and %d)\n", MIN_BAUD_RATE, MAX_BAUD_RATE);
         exit(2);
     }
 
@@ -53,21 +57,201 @@ int main(int argc, char *argv[])
         exit(3);
     }
 
+    // Parse optional settings
+    ApplicationOptions options;
+    memset(&options, 0, sizeof(options));
+    const char *traceFile = NULL;
+
+    for (int i = 5; i < argc; i++)
+    {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--arq") == 0 && value != NULL)
+        {
+            if (strcmp(value, "sw") == 0)
+                options.link.arqMode = LlStopAndWait;
+            else if (strcmp(value, "gbn") == 0)
+                options.link.arqMode = LlGoBackN;
+            else if (strcmp(value, "sr") == 0)
+                options.link.arqMode = LlSelectiveRepeat;
+            else
+            {
+                printf("ERROR: ARQ mode must be \"sw\", \"gbn\" or \"sr\"\n");
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--window") == 0 && value != NULL)
+        {
+            options.link.windowSize = atoi(value);
+            if (options.link.windowSize < 1 || options.link.windowSize > MAX_WINDOW_SIZE)
+            {
+                printf("ERROR: Window must be between 1 and %d\n", MAX_WINDOW_SIZE);
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--fcs") == 0 && value != NULL)
+        {
+            if (strcmp(value, "xor") == 0)
+                options.link.fcsMode = LlFcsXor;
+            else if (strcmp(value, "crc16") == 0)
+                options.link.fcsMode = LlFcsCrc16;
+            else if (strcmp(value, "crc32c") == 0)
+                options.link.fcsMode = LlFcsCrc32c;
+            else
+            {
+                printf("ERROR: Frame check must be \"xor\", \"crc16\" or \"crc32c\"\n");
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--timeout-ms") == 0 && value != NULL)
+        {
+            options.link.timeoutMs = atoi(value);
+            if (options.link.timeoutMs < 1)
+            {
+                printf("ERROR: Timeout must be a positive number of milliseconds\n");
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--max-payload") == 0 && value != NULL)
+        {
+            options.link.maxPayload = atoi(value);
+            if (options.link.maxPayload < MAX_PAYLOAD_SIZE || options.link.maxPayload > MAX_PAYLOAD_LIMIT)
+            {
+                printf("ERROR: Max payload must be between %d and %d\n", MAX_PAYLOAD_SIZE, MAX_PAYLOAD_LIMIT);
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--duplex") == 0 && value != NULL)
+        {
+            options.link.duplex = TRUE;
+            options.duplexFile = value;
+            i++;
+        }
+        else if (strcmp(argv[i], "--compress") == 0)
+        {
+            options.compress = TRUE;
+        }
+        else if (strcmp(argv[i], "--fec") == 0 && value != NULL)
+        {
+            options.link.fecErrors = atoi(value);
+            if (options.link.fecErrors < 0 || options.link.fecErrors > MAX_FEC_ERRORS)
+            {
+                printf("ERROR: FEC must repair between 0 and %d byte errors per block\n", MAX_FEC_ERRORS);
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--flow") == 0 && value != NULL)
+        {
+            if (strcmp(value, "none") == 0)
+                options.link.flowControl = LlFlowNone;
+            else if (strcmp(value, "rtscts") == 0)
+                options.link.flowControl = LlFlowRtsCts;
+            else if (strcmp(value, "xonxoff") == 0)
+                options.link.flowControl = LlFlowXonXoff;
+            else
+            {
+                printf("ERROR: Flow control must be \"none\", \"rtscts\" or \"xonxoff\"\n");
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--max-baud") == 0 && value != NULL)
+        {
+            options.link.maxBaudRate = atoi(value);
+            if (options.link.maxBaudRate < MIN_BAUD_RATE || options.link.maxBaudRate > MAX_BAUD_RATE)
+            {
+                printf("ERROR: Max baud rate must be between %d and %d\n", MIN_BAUD_RATE, MAX_BAUD_RATE);
+                exit(4);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && value != NULL)
+        {
+            options.link.statsJson = value;
+            i++;
+        }
+        else if (strcmp(argv[i], "--stats-csv") == 0 && value != NULL)
+        {
+            options.link.statsCsv = value;
+            i++;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && value != NULL)
+        {
+            traceFile = value;
+            trace_enable();
+            i++;
+        }
+        else if (strcmp(argv[i], "--bond") == 0 && value != NULL)
+        {
+            if (options.bondPortCount == MAX_BOND_LINKS - 1)
+            {
+                printf("ERROR: At most %d ports can be bonded\n", MAX_BOND_LINKS);
+                exit(4);
+            }
+            options.bondPorts[options.bondPortCount++] = value;
+            i++;
+        }
+        else
+        {
+            printf("ERROR: Unknown option \"%s\"\n", argv[i]);
+            exit(4);
+        }
+    }
+
+    if (options.bondPortCount > 0 && options.link.duplex)
+    {
+        printf("ERROR: Bonded ports cannot be used with --duplex\n");
+        exit(4);
+    }
+    if (options.bondPortCount > 0 && options.compress)
+    {
+        printf("ERROR: Bonded ports cannot be used with --compress\n");
+        exit(4);
+    }
+
     printf("Starting link-layer protocol application\n"
            "  - Serial port: %s\n"
            "  - Role: %s\n"
            "  - Baudrate: %d\n"
            "  - Number of tries: %d\n"
-           "  - Timeout: %d\n"
-           "  - Filename: %s\n",
+           "  - Timeout: %d ms\n"
+           "  - Filename: %s\n"
+           "  - ARQ: %s (window %d)\n"
+           "  - Frame check: %s\n"
+           "  - Flow control: %s\n",
            serialPort,
            role,
            baudrate,
            N_TRIES,
-           TIMEOUT,
-           filename);
+           options.link.timeoutMs > 0 ? options.link.timeoutMs : TIMEOUT * 1000,
+           filename,
+           options.link.arqMode == LlGoBackN           ? "Go-Back-N"
+           : options.link.arqMode == LlSelectiveRepeat ? "Selective Repeat"
+                                                       : "Stop-and-wait",
+           options.link.windowSize,
+           options.link.fcsMode == LlFcsCrc16    ? "CRC-16-CCITT"
+           : options.link.fcsMode == LlFcsCrc32c ? "CRC-32C"
+                                                 : "XOR",
+           options.link.flowControl == LlFlowRtsCts    ? "RTS/CTS"
+           : options.link.flowControl == LlFlowXonXoff ? "XON/XOFF"
+                                                       : "none");
+    for (int i = 0; i < options.bondPortCount; i++)
+    {
+        printf("  - Bonded port: %s\n", options.bondPorts[i]);
+    }
 
-    applicationLayer(serialPort, role, baudrate, N_TRIES, TIMEOUT, filename);
+    applicationLayer(serialPort, role, baudrate, N_TRIES, TIMEOUT, filename, &options);
+
+    if (traceFile != NULL && trace_dump(traceFile) == 0)
+    {
+        printf("Trace written to %s\n", traceFile);
+    }
 
     return 0;
 }
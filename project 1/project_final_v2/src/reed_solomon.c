@@ -0,0 +1,227 @@
+// Reed-Solomon forward error correction.
+// Systematic code over GF(2^8) (polynomial 0x11D) with the generator roots
+// alpha^0 .. alpha^(parity - 1). Short blocks are shortened codewords, as if
+// padded with leading zeros. Decoding finds the error locator with
+// Berlekamp-Massey, the error positions with a Chien search and the error
+// values with Forney's formula.
+
+#include "reed_solomon.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define GF_POLY 0x11D
+
+typedef struct {
+    unsigned char exp[2 * RS_BLOCK_SIZE];
+    unsigned char log[256];
+    // generator[p] holds the p + 1 coefficients of the generator for p parity
+    // bytes, highest degree first
+    unsigned char generator[RS_MAX_PARITY + 1][RS_MAX_PARITY + 1];
+} RsTables;
+
+static RsTables tables;
+
+// Links may run on several threads, so the tables are built exactly once
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+////////////////////////////////////////////////
+// GF(2^8) arithmetic
+////////////////////////////////////////////////
+static unsigned char gf_mul(unsigned char a, unsigned char b) {
+    if (a == 0 || b == 0) return 0;
+    return tables.exp[tables.log[a] + tables.log[b]];
+}
+
+static unsigned char gf_div(unsigned char a, unsigned char b) {
+    if (a == 0) return 0;
+    return tables.exp[tables.log[a] + RS_BLOCK_SIZE - tables.log[b]];
+}
+
+// alpha^power for any power >= 0
+static unsigned char gf_pow(int power) {
+    return tables.exp[power % RS_BLOCK_SIZE];
+}
+
+static void build_tables(void) {
+    int x = 1;
+    for (int i = 0; i < RS_BLOCK_SIZE; i++) {
+        tables.exp[i] = x;
+        tables.exp[i + RS_BLOCK_SIZE] = x;
+        tables.log[x] = i;
+        x <<= 1;
+        if (x & 0x100) x ^= GF_POLY;
+    }
+
+    // Multiply in one (x - alpha^i) factor per parity byte
+    unsigned char *previous = tables.generator[0];
+    previous[0] = 1;
+    for (int p = 1; p <= RS_MAX_PARITY; p++) {
+        unsigned char *current = tables.generator[p];
+        unsigned char root = tables.exp[p - 1];
+        current[0] = 1;
+        for (int j = 1; j < p; j++) {
+            current[j] = previous[j] ^ gf_mul(previous[j - 1], root);
+        }
+        current[p] = gf_mul(previous[p - 1], root);
+        previous = current;
+    }
+}
+
+////////////////////////////////////////////////
+// Encoding
+////////////////////////////////////////////////
+int rs_encoded_size(int length, int parity) {
+    int block_data = RS_BLOCK_SIZE - parity;
+    int blocks = (length + block_data - 1) / block_data;
+    return length + blocks * parity;
+}
+
+// The parity bytes are the remainder of data * x^parity divided by the
+// generator, worked out one data byte at a time
+static void encode_block(const unsigned char *data, int length, int parity, unsigned char *check) {
+    const unsigned char *generator = tables.generator[parity];
+    memset(check, 0, parity);
+
+    for (int i = 0; i < length; i++) {
+        unsigned char feedback = data[i] ^ check[0];
+        for (int j = 0; j < parity - 1; j++) {
+            check[j] = check[j + 1] ^ gf_mul(feedback, generator[j + 1]);
+        }
+        check[parity - 1] = gf_mul(feedback, generator[parity]);
+    }
+}
+
+int rs_encode(const unsigned char *data, int length, int parity, unsigned char *out) {
+    pthread_once(&tables_once, build_tables);
+
+    int block_data = RS_BLOCK_SIZE - parity;
+    int out_idx = 0;
+    for (int idx = 0; idx < length; idx += block_data) {
+        int chunk = length - idx < block_data ? length - idx : block_data;
+        memcpy(&out[out_idx], &data[idx], chunk);
+        encode_block(&data[idx], chunk, parity, &out[out_idx + chunk]);
+        out_idx += chunk + parity;
+    }
+    return out_idx;
+}
+
+////////////////////////////////////////////////
+// Decoding
+////////////////////////////////////////////////
+
+// Repair one codeword of n bytes in place; byte i is the coefficient of
+// x^(n - 1 - i). Returns the number of bytes repaired, or -1.
+static int decode_block(unsigned char *block, int n, int parity) {
+    unsigned char syndromes[RS_MAX_PARITY];
+    int clean = 1;
+    for (int j = 0; j < parity; j++) {
+        unsigned char root = gf_pow(j);
+        unsigned char s = 0;
+        for (int i = 0; i < n; i++) {
+            s = gf_mul(s, root) ^ block[i];
+        }
+        syndromes[j] = s;
+        if (s != 0) clean = 0;
+    }
+    if (clean) return 0;
+
+    // Berlekamp-Massey: shortest LFSR (error locator, lowest degree first)
+    // that generates the syndromes
+    unsigned char locator[RS_MAX_PARITY + 1] = {1};
+    unsigned char previous[RS_MAX_PARITY + 1] = {1};
+    int errors = 0;
+    int shift = 1;
+    unsigned char previous_discrepancy = 1;
+
+    for (int step = 0; step < parity; step++) {
+        unsigned char discrepancy = syndromes[step];
+        for (int i = 1; i <= errors; i++) {
+            discrepancy ^= gf_mul(locator[i], syndromes[step - i]);
+        }
+        if (discrepancy == 0) {
+            shift++;
+            continue;
+        }
+
+        unsigned char saved[RS_MAX_PARITY + 1];
+        memcpy(saved, locator, sizeof(saved));
+        unsigned char scale = gf_div(discrepancy, previous_discrepancy);
+        for (int i = 0; i + shift <= parity; i++) {
+            locator[i + shift] ^= gf_mul(scale, previous[i]);
+        }
+
+        if (2 * errors <= step) {
+            errors = step + 1 - errors;
+            memcpy(previous, saved, sizeof(previous));
+            previous_discrepancy = discrepancy;
+            shift = 1;
+        } else {
+            shift++;
+        }
+    }
+    if (2 * errors > parity) return -1;
+
+    // Error evaluator: syndromes * locator mod x^parity
+    unsigned char evaluator[RS_MAX_PARITY];
+    for (int i = 0; i < parity; i++) {
+        unsigned char value = 0;
+        for (int j = 0; j <= i && j <= errors; j++) {
+            value ^= gf_mul(locator[j], syndromes[i - j]);
+        }
+        evaluator[i] = value;
+    }
+
+    // Chien search over the positions this (possibly shortened) block has
+    int found = 0;
+    for (int i = 0; i < n; i++) {
+        int power = n - 1 - i;
+        unsigned char inverse = gf_pow(RS_BLOCK_SIZE - power); // X^-1
+
+        unsigned char value = 0;
+        unsigned char derivative = 0;
+        unsigned char x_power = 1;
+        for (int j = 0; j <= errors; j++) {
+            value ^= gf_mul(locator[j], x_power);
+            // Formal derivative: only odd terms survive in characteristic 2
+            if (j & 1) derivative ^= gf_mul(locator[j], gf_div(x_power, inverse));
+            x_power = gf_mul(x_power, inverse);
+        }
+        if (value != 0) continue;
+        if (derivative == 0) return -1;
+
+        // Forney, first root alpha^0: e = X * omega(X^-1) / lambda'(X^-1)
+        unsigned char omega = 0;
+        x_power = 1;
+        for (int j = 0; j < parity; j++) {
+            omega ^= gf_mul(evaluator[j], x_power);
+            x_power = gf_mul(x_power, inverse);
+        }
+        block[i] ^= gf_mul(gf_pow(power), gf_div(omega, derivative));
+        found++;
+    }
+
+    // Roots outside the block mean more errors than the code can see
+    return found == errors ? errors : -1;
+}
+
+int rs_decode(unsigned char *buffer, int length, int parity, int *corrected) {
+    pthread_once(&tables_once, build_tables);
+    *corrected = 0;
+
+    int data_length = 0;
+    int idx = 0;
+    while (idx < length) {
+        int n = length - idx < RS_BLOCK_SIZE ? length - idx : RS_BLOCK_SIZE;
+        if (n <= parity) return -1;
+
+        int repaired = decode_block(&buffer[idx], n, parity);
+        if (repaired < 0) return -1;
+        *corrected += repaired;
+
+        memmove(&buffer[data_length], &buffer[idx], n - parity);
+        data_length += n - parity;
+        idx += n;
+    }
+    return data_length;
+}
@@ -0,0 +1,27 @@
+// Reed-Solomon forward error correction header.
+
+#ifndef _REED_SOLOMON_H_
+#define _REED_SOLOMON_H_
+
+// A codeword holds at most RS_BLOCK_SIZE bytes, "parity" of them check
+// bytes, and repairs up to parity / 2 corrupted bytes anywhere in it.
+#define RS_BLOCK_SIZE 255
+#define RS_MAX_PARITY 32
+
+// Size of "length" bytes once encoded: the data is cut into blocks of
+// RS_BLOCK_SIZE - parity bytes, each followed by its parity bytes.
+int rs_encoded_size(int length, int parity);
+
+// Encode "length" bytes from data into out, which must have room for
+// rs_encoded_size(length, parity) bytes.
+// Returns the number of bytes written to out.
+int rs_encode(const unsigned char *data, int length, int parity, unsigned char *out);
+
+// Repair and strip the parity of an encoded buffer in place; the data ends
+// up at the start of the buffer. *corrected receives the number of bytes
+// repaired.
+// Returns the data length, or -1 if a block has more errors than it can
+// repair.
+int rs_decode(unsigned char *buffer, int length, int parity, int *corrected);
+
+#endif // _REED_SOLOMON_H_
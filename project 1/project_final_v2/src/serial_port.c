@@ -2,8 +2,10 @@
 // DO NOT CHANGE THIS FILE
 
 #include "serial_port.h"
+#include "serial_speed.h"
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -17,14 +19,57 @@
 int fd = -1;           // File descriptor for open serial port
 struct termios oldtio; // Serial port settings to restore on closing
 
+// Convert a baud rate to its Bnnn flag.
+// Returns 1 if there is one, 0 if the rate has to be set through termios2.
+static int standardBaudRate(int baudRate, tcflag_t *br)
+{
+    // Baudrate settings are defined in <asm/termbits.h>, which is included by <termios.h>
+#define CASE_BAUDRATE(baudrate) \
+    case baudrate:              \
+        *br = B##baudrate;      \
+        return 1;
+
+    switch (baudRate)
+    {
+        CASE_BAUDRATE(1200);
+        CASE_BAUDRATE(1800);
+        CASE_BAUDRATE(2400);
+        CASE_BAUDRATE(4800);
+        CASE_BAUDRATE(9600);
+        CASE_BAUDRATE(19200);
+        CASE_BAUDRATE(38400);
+        CASE_BAUDRATE(57600);
+        CASE_BAUDRATE(115200);
+        CASE_BAUDRATE(230400);
+        CASE_BAUDRATE(460800);
+        CASE_BAUDRATE(921600);
+        CASE_BAUDRATE(1000000);
+        CASE_BAUDRATE(1500000);
+        CASE_BAUDRATE(2000000);
+        CASE_BAUDRATE(3000000);
+        CASE_BAUDRATE(4000000);
+    default:
+        return 0;
+    }
+#undef CASE_BAUDRATE
+}
+
 // Open and configure the serial port.
 // Returns -1 on error.
 int openSerialPort(const char *serialPort, int baudRate)
+{
+    fd = openSerialPortFd(serialPort, baudRate, &oldtio);
+    return fd;
+}
+
+// Open and configure the serial port, saving its current settings in
+// savedSettings. Returns the file descriptor, or -1 on error.
+int openSerialPortFd(const char *serialPort, int baudRate, struct termios *savedSettings)
 {
     // Open with O_NONBLOCK to avoid hanging when CLOCAL
     // is not yet set on the serial port (changed later)
     int oflags = O_RDWR | O_NOCTTY | O_NONBLOCK;
-    fd = open(serialPort, oflags);
+    int fd = open(serialPort, oflags);
     if (fd < 0)
     {
         perror(serialPort);
@@ -32,37 +77,27 @@ int openSerialPort(const char *serialPort, int baudRate)
     }
 
     // Save current port settings
-    if (tcgetattr(fd, &oldtio) == -1)
+    if (tcgetattr(fd, savedSettings) == -1)
     {
         perror("tcgetattr");
+        close(fd);
         return -1;
     }
 
-    // Convert baud rate to appropriate flag
-
-    // Baudrate settings are defined in <asm/termbits.h>, which is included by <termios.h>
-#define CASE_BAUDRATE(baudrate) \
-    case baudrate:              \
-        br = B##baudrate;       \
-        break;
-
+    // Other rates go through termios2 once the port is configured
     tcflag_t br;
-    switch (baudRate)
+    int customRate = !standardBaudRate(baudRate, &br);
+    if (customRate)
     {
-        CASE_BAUDRATE(1200);
-        CASE_BAUDRATE(1800);
-        CASE_BAUDRATE(2400);
-        CASE_BAUDRATE(4800);
-        CASE_BAUDRATE(9600);
-        CASE_BAUDRATE(19200);
-        CASE_BAUDRATE(38400);
-        CASE_BAUDRATE(57600);
-        CASE_BAUDRATE(115200);
-    default:
-        fprintf(stderr, "Unsupported baud rate (must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200)\n");
-        return -1;
+        if (baudRate < MIN_BAUD_RATE || baudRate > MAX_BAUD_RATE)
+        {
+            fprintf(stderr, "Unsupported baud rate (must be between %d and %d)\n",
+                    MIN_BAUD_RATE, MAX_BAUD_RATE);
+            close(fd);
+            return -1;
+        }
+        br = B38400;
     }
-#undef CASE_BAUDRATE
 
     // New port settings
     struct termios newtio;
@@ -75,7 +110,7 @@ int openSerialPort(const char *serialPort, int baudRate)
     // Set input mode (non-canonical, no echo,...)
     newtio.c_lflag = 0;
     newtio.c_cc[VTIME] = 0; // Block reading
-    newtio.c_cc[VMIN] = 1;  // Byte by byte
+    newtio.c_cc[VMIN] = 1;  // Until the first byte, then return all that is buffered
 
     tcflush(fd, TCIOFLUSH);
 
@@ -87,6 +122,12 @@ int openSerialPort(const char *serialPort, int baudRate)
         return -1;
     }
 
+    if (customRate && setCustomBaudRate(fd, baudRate) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
     // Clear O_NONBLOCK flag to ensure blocking reads
     oflags ^= O_NONBLOCK;
     if (fcntl(fd, F_SETFL, oflags) == -1)
@@ -102,17 +143,103 @@ int openSerialPort(const char *serialPort, int baudRate)
 // Restore original port settings and close the serial port.
 // Returns 0 on success and -1 on error.
 int closeSerialPort()
+{
+    return closeSerialPortFd(fd, &oldtio);
+}
+
+// Restore the settings saved by openSerialPortFd() and close the port.
+// Returns 0 on success and -1 on error.
+int closeSerialPortFd(int fd, const struct termios *savedSettings)
 {
     // Restore the old port settings
-    if (tcsetattr(fd, TCSANOW, &oldtio) == -1)
+    if (tcsetattr(fd, TCSANOW, savedSettings) == -1)
     {
         perror("tcsetattr");
+        close(fd);
         return -1;
     }
 
     return close(fd);
 }
 
+// Change the baud rate of an open port, keeping its other settings.
+// Returns 0 on success and -1 on error.
+int setSerialPortBaudRate(int baudRate)
+{
+    return setSerialPortBaudRateFd(fd, baudRate);
+}
+
+int setSerialPortBaudRateFd(int fd, int baudRate)
+{
+    tcflag_t br;
+    if (!standardBaudRate(baudRate, &br))
+    {
+        if (baudRate < MIN_BAUD_RATE || baudRate > MAX_BAUD_RATE)
+        {
+            fprintf(stderr, "Unsupported baud rate (must be between %d and %d)\n",
+                    MIN_BAUD_RATE, MAX_BAUD_RATE);
+            return -1;
+        }
+        return setCustomBaudRate(fd, baudRate);
+    }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == -1)
+    {
+        perror("tcgetattr");
+        return -1;
+    }
+
+    // No separate input rate: it follows the output one
+    tio.c_cflag &= ~(CBAUD | CIBAUD);
+    tio.c_cflag |= br;
+    if (tcsetattr(fd, TCSANOW, &tio) == -1)
+    {
+        perror("tcsetattr");
+        return -1;
+    }
+    return 0;
+}
+
+// Turn RTS/CTS and XON/XOFF flow control on or off.
+// Returns 0 on success and -1 on error.
+int setSerialPortFlowControl(int rtsCts, int xonXoff)
+{
+    return setSerialPortFlowControlFd(fd, rtsCts, xonXoff);
+}
+
+int setSerialPortFlowControlFd(int fd, int rtsCts, int xonXoff)
+{
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == -1)
+    {
+        perror("tcgetattr");
+        return -1;
+    }
+
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+    if (rtsCts)
+    {
+        tio.c_cflag |= CRTSCTS;
+    }
+    if (xonXoff)
+    {
+        // IXON: stop sending on XOFF; IXOFF: send XOFF when the input queue fills up
+        tio.c_iflag |= IXON | IXOFF;
+        tio.c_cc[VSTART] = 0x11;
+        tio.c_cc[VSTOP] = 0x13;
+    }
+
+    // Only the flags change, so a termios2 baud rate is kept
+    if (tcsetattr(fd, TCSANOW, &tio) == -1)
+    {
+        perror("tcsetattr");
+        return -1;
+    }
+    return 0;
+}
+
 // Wait up to 0.1 second (VTIME) for a byte received from the serial port.
 // Must check whether a byte was actually received from the return value.
 // Save the received byte in the "byte" pointer.
@@ -122,6 +249,31 @@ int readByteSerialPort(unsigned char *byte)
     return read(fd, byte, 1);
 }
 
+// Wait up to timeoutMs milliseconds (-1 forever, 0 to only check) for data
+// and read everything received so far, up to maxBytes.
+// Returns -1 on error, 0 if nothing was received, otherwise the number of bytes read.
+int readBytesSerialPort(unsigned char *bytes, int maxBytes, int timeoutMs)
+{
+    return readBytesSerialPortFd(fd, bytes, maxBytes, timeoutMs);
+}
+
+int readBytesSerialPortFd(int fd, unsigned char *bytes, int maxBytes, int timeoutMs)
+{
+    // With VMIN=1 and VTIME=0, read() already waits for the first byte and
+    // then hands over the whole burst; poll() only bounds the wait
+    if (timeoutMs >= 0)
+    {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, timeoutMs);
+        if (ready <= 0)
+        {
+            return ready;
+        }
+    }
+
+    return read(fd, bytes, maxBytes);
+}
+
 // Write up to numBytes from the "bytes" array to the serial port.
 // Must check how many were actually written in the return value.
 // Returns -1 on error, otherwise the number of bytes written.
@@ -4,6 +4,8 @@
 #ifndef _SERIAL_PORT_H_
 #define _SERIAL_PORT_H_
 
+#include <termios.h>
+
 // Open and configure the serial port.
 // Returns a positive number if the port was opened successfully or -1 on error.
 int openSerialPort(const char *serialPort, int baudRate);
@@ -12,11 +14,35 @@ int openSerialPort(const char *serialPort, int baudRate);
 // Returns 0 if the port was closed successfully or -1 on error.
 int closeSerialPort();
 
+// Variants for processes that keep several ports open at once: the original
+// port settings are kept in *savedSettings instead of a global.
+// openSerialPortFd() returns the file descriptor, or -1 on error.
+int openSerialPortFd(const char *serialPort, int baudRate, struct termios *savedSettings);
+int closeSerialPortFd(int fd, const struct termios *savedSettings);
+
+// Change the baud rate of an open port, keeping its other settings.
+// Returns 0 on success or -1 on error.
+int setSerialPortBaudRate(int baudRate);
+int setSerialPortBaudRateFd(int fd, int baudRate);
+
+// Turn RTS/CTS (CRTSCTS) and XON/XOFF (IXON/IXOFF) flow control on or off
+// on an open port. Returns 0 on success or -1 on error.
+int setSerialPortFlowControl(int rtsCts, int xonXoff);
+int setSerialPortFlowControlFd(int fd, int rtsCts, int xonXoff);
+
 // Wait up to 0.1 second (VTIME) for a byte received from the serial port (must
 // check whether a byte was actually received from the return value).
 // Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
 int readByteSerialPort(unsigned char *byte);
 
+// Wait up to timeoutMs milliseconds (-1 forever, 0 to only check) for data
+// received from the serial port, then read everything that has arrived, up
+// to maxBytes, so a whole burst comes back in one call.
+// Returns -1 on error, 0 if nothing was received, otherwise the number of
+// bytes read.
+int readBytesSerialPort(unsigned char *bytes, int maxBytes, int timeoutMs);
+int readBytesSerialPortFd(int fd, unsigned char *bytes, int maxBytes, int timeoutMs);
+
 // Write up to numBytes to the serial port (must check how many were actually
 // written in the return value).
 // Returns -1 on error, otherwise the number of bytes written.
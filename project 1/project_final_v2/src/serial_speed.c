@@ -0,0 +1,40 @@
+// Arbitrary serial port speeds through the Linux termios2 interface.
+// <asm/termbits.h> declares its own struct termios, which clashes with the
+// one in <termios.h>, so this lives apart from serial_port.c.
+
+#include "serial_speed.h"
+
+#include <asm/termbits.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+
+int setCustomBaudRate(int fd, int baudRate)
+{
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) == -1)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+
+    // BOTHER: the rate is taken from c_ispeed/c_ospeed as a plain number
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_cflag &= ~(CBAUD << IBSHIFT);
+    tio.c_cflag |= BOTHER << IBSHIFT;
+    tio.c_ispeed = baudRate;
+    tio.c_ospeed = baudRate;
+
+    if (ioctl(fd, TCSETS2, &tio) == -1)
+    {
+        perror("TCSETS2");
+        return -1;
+    }
+
+    // Drivers round to what their clock can divide down to
+    if (ioctl(fd, TCGETS2, &tio) == 0 && tio.c_ospeed != (speed_t)baudRate)
+    {
+        printf("Baud rate %d set as %u\n", baudRate, tio.c_ospeed);
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+// Serial port speed header.
+
+#ifndef _SERIAL_SPEED_H_
+#define _SERIAL_SPEED_H_
+
+// Rates the application accepts. Those without a Bnnn constant are set
+// through termios2/BOTHER, so the driver decides how close it can get.
+#define MIN_BAUD_RATE 50
+#define MAX_BAUD_RATE 12000000
+
+// Set any baud rate, in both directions, on an open and configured port.
+// Returns 0 on success or -1 on error.
+int setCustomBaudRate(int fd, int baudRate);
+
+#endif // _SERIAL_SPEED_H_
@@ -0,0 +1,184 @@
+// Link event tracing.
+// Events go into a fixed ring shared by every session. A writer claims the
+// next slot with one atomic increment and fills it in, so threads never wait
+// on each other; the ring is only read once the links are done with it.
+
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static TraceEvent ring[TRACE_RING_SIZE];
+static atomic_ulong recorded;     // Events ever recorded; the next slot is this modulo the size
+static atomic_int enabled;
+static char names[TRACE_MAX_SESSIONS][TRACE_NAME_SIZE];
+static atomic_int registered;
+
+void trace_enable(void) {
+    atomic_store(&enabled, 1);
+}
+
+int trace_register(const char *name) {
+    int id = atomic_fetch_add(&registered, 1);
+    if (id >= TRACE_MAX_SESSIONS) return TRACE_MAX_SESSIONS - 1;
+    strncpy(names[id], name, TRACE_NAME_SIZE - 1);
+    return id;
+}
+
+void trace_event(int session, TraceEventType type, int seq, int value) {
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    unsigned long slot = atomic_fetch_add_explicit(&recorded, 1, memory_order_relaxed);
+    TraceEvent *event = &ring[slot % TRACE_RING_SIZE];
+    event->time_ns = (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+    event->session = session;
+    event->type = type;
+    event->seq = seq;
+    event->value = value;
+}
+
+int trace_dump(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    unsigned long total = atomic_load(&recorded);
+    unsigned long count = total < TRACE_RING_SIZE ? total : TRACE_RING_SIZE;
+    int sessions = atomic_load(&registered);
+    if (sessions > TRACE_MAX_SESSIONS) sessions = TRACE_MAX_SESSIONS;
+
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.session_count = sessions;
+    header.event_count = count;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(names, TRACE_NAME_SIZE, sessions, file) == (size_t)sessions;
+
+    // Oldest first: once the ring wrapped, that is the slot after the newest
+    for (unsigned long i = total - count; ok && i < total; i++) {
+        ok = fwrite(&ring[i % TRACE_RING_SIZE], sizeof(TraceEvent), 1, file) == 1;
+    }
+    if (fclose(file) != 0) ok = 0;
+
+    if (!ok) {
+        perror(path);
+        return -1;
+    }
+    if (total > count) {
+        printf("Trace: ring full, kept the last %lu of %lu events\n", count, total);
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////
+// Chrome trace conversion
+////////////////////////////////////////////////
+
+// Name of each event type; the ll* calls are slices, the rest instants
+static const char *event_name(int type) {
+    switch (type) {
+        case TRACE_OPEN_BEGIN: case TRACE_OPEN_END: return "llopen";
+        case TRACE_WRITE_BEGIN: case TRACE_WRITE_END: return "llwrite";
+        case TRACE_READ_BEGIN: case TRACE_READ_END: return "llread";
+        case TRACE_CLOSE_BEGIN: case TRACE_CLOSE_END: return "llclose";
+        case TRACE_FRAME_TX: return "I-frame sent";
+        case TRACE_FRAME_RETX: return "I-frame resent";
+        case TRACE_FRAME_RX: return "I-frame accepted";
+        case TRACE_DUPLICATE: return "Duplicate I-frame";
+        case TRACE_RR_TX: return "RR sent";
+        case TRACE_REJ_TX: return "REJ sent";
+        case TRACE_SREJ_TX: return "SREJ sent";
+        case TRACE_RR_RX: return "RR received";
+        case TRACE_REJ_RX: return "REJ received";
+        case TRACE_SREJ_RX: return "SREJ received";
+        case TRACE_TIMEOUT: return "Timeout";
+        case TRACE_BCC1_ERROR: return "BCC1 error";
+        case TRACE_BCC2_ERROR: return "BCC2 error";
+        case TRACE_RESYNC: return "Resync";
+        case TRACE_BAUD_RATE: return "Baud rate";
+        default: return "Unknown";
+    }
+}
+
+// Phase of the event: B(egin), E(nd) or i(nstant)
+static char event_phase(int type) {
+    switch (type) {
+        case TRACE_OPEN_BEGIN: case TRACE_WRITE_BEGIN:
+        case TRACE_READ_BEGIN: case TRACE_CLOSE_BEGIN:
+            return 'B';
+        case TRACE_OPEN_END: case TRACE_WRITE_END:
+        case TRACE_READ_END: case TRACE_CLOSE_END:
+            return 'E';
+        default:
+            return 'i';
+    }
+}
+
+int trace_convert_chrome(const char *dump_path, const char *json_path) {
+    FILE *in = fopen(dump_path, "rb");
+    if (in == NULL) {
+        perror(dump_path);
+        return -1;
+    }
+
+    TraceFileHeader header;
+    char session_names[TRACE_MAX_SESSIONS][TRACE_NAME_SIZE];
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.session_count > TRACE_MAX_SESSIONS ||
+        fread(session_names, TRACE_NAME_SIZE, header.session_count, in) != header.session_count) {
+        printf("%s: not a link trace\n", dump_path);
+        fclose(in);
+        return -1;
+    }
+
+    FILE *out = fopen(json_path, "w");
+    if (out == NULL) {
+        perror(json_path);
+        fclose(in);
+        return -1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"link layer\"}}");
+    for (uint32_t i = 0; i < header.session_count; i++) {
+        session_names[i][TRACE_NAME_SIZE - 1] = '\0';
+        fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                "\"args\": {\"name\": \"%s\"}}", i, session_names[i]);
+    }
+
+    // Times relative to the first event, in microseconds
+    TraceEvent event;
+    uint64_t start_ns = 0;
+    uint32_t converted = 0;
+    while (converted < header.event_count && fread(&event, sizeof(event), 1, in) == 1) {
+        if (converted++ == 0) start_ns = event.time_ns;
+        char phase = event_phase(event.type);
+        fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u",
+                event_name(event.type), phase, (event.time_ns - start_ns) / 1000.0, event.session);
+        if (phase == 'i') fprintf(out, ", \"s\": \"t\"");
+        if (phase != 'B' || event.value != 0) {
+            fprintf(out, ", \"args\": {\"seq\": %u, \"value\": %d}", event.seq, (int32_t)event.value);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n]}\n");
+
+    fclose(in);
+    if (fclose(out) != 0) {
+        perror(json_path);
+        return -1;
+    }
+    if (converted < header.event_count) {
+        printf("%s: truncated, converted %u of %u events\n", dump_path, converted, header.event_count);
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Link event tracing header.
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+// Events kept in memory; once the ring is full the oldest are overwritten.
+#define TRACE_RING_SIZE 65536
+
+// Sessions that can be named in a trace.
+#define TRACE_MAX_SESSIONS 64
+#define TRACE_NAME_SIZE 50
+
+typedef enum
+{
+    // Calls into the link layer, traced as begin/end pairs
+    TRACE_OPEN_BEGIN,
+    TRACE_OPEN_END,   // value: 0 on success, -1 on error
+    TRACE_WRITE_BEGIN, // value: payload bytes
+    TRACE_WRITE_END,
+    TRACE_READ_BEGIN,
+    TRACE_READ_END,   // value: payload bytes returned
+    TRACE_CLOSE_BEGIN,
+    TRACE_CLOSE_END,  // value: 0 on success, -1 on error
+    // Frames and timers; seq is the frame (or acknowledgement) number
+    TRACE_FRAME_TX,   // value: bytes on the wire
+    TRACE_FRAME_RETX, // value: bytes on the wire
+    TRACE_FRAME_RX,   // I-frame accepted; value: payload bytes
+    TRACE_DUPLICATE,
+    TRACE_RR_TX,
+    TRACE_REJ_TX,
+    TRACE_SREJ_TX,
+    TRACE_RR_RX,      // value: frames acknowledged
+    TRACE_REJ_RX,
+    TRACE_SREJ_RX,
+    TRACE_TIMEOUT,    // value: retransmission timeout after backing off, ms
+    TRACE_BCC1_ERROR,
+    TRACE_BCC2_ERROR,
+    TRACE_RESYNC,     // Parser dropped a partial frame; value: parser state
+    TRACE_BAUD_RATE,  // Port switched rate; value: new baud rate
+    TRACE_EVENT_TYPES
+} TraceEventType;
+
+// One event as it is kept in memory and in the dump file.
+typedef struct
+{
+    uint64_t time_ns; // CLOCK_MONOTONIC
+    uint16_t session;
+    uint8_t type;
+    uint8_t seq;
+    uint32_t value;
+} TraceEvent;
+
+// Dump file: this header, session_count names of TRACE_NAME_SIZE bytes, then
+// event_count events, oldest first. Fields are in host byte order.
+#define TRACE_MAGIC "LLTRACE1"
+typedef struct
+{
+    char magic[8];
+    uint32_t session_count;
+    uint32_t event_count;
+} TraceFileHeader;
+
+// Start recording. Until then trace_event() returns right away.
+void trace_enable(void);
+
+// Id under which a session's events are recorded; name shows up in the
+// converted trace. Sessions past TRACE_MAX_SESSIONS share the last id.
+int trace_register(const char *name);
+
+// Record an event. Safe to call from any thread, without locks.
+void trace_event(int session, TraceEventType type, int seq, int value);
+
+// Write the events still in the ring to path.
+// Return 0 on success or -1 on error.
+int trace_dump(const char *path);
+
+// Convert a dump to the Chrome trace event format (chrome://tracing,
+// Perfetto): link calls as slices, everything else as instant events, one
+// track per session.
+// Return 0 on success or -1 on error.
+int trace_convert_chrome(const char *dump_path, const char *json_path);
+
+#endif // _TRACE_H_
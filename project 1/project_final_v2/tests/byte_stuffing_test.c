@@ -0,0 +1,176 @@
+// Check that the SSE2 and AVX2 stuffing kernels produce exactly what the
+// scalar ones do. Each kernel stuffs, measures and destuffs random buffers
+// and pathological ones (all FRAME_FLAG, all ESCAPE_BYTE, all XON/XOFF,
+// alternating specials) of every tail length from 0 to 64 past a few
+// vector-sized bodies, with and without XON/XOFF escaping. The SIMD kernels
+// only run where the CPU has them.
+//
+// Build: gcc -Wall -o bin/byte_stuffing_test tests/byte_stuffing_test.c
+// Run:   ./bin/byte_stuffing_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The kernels are private to the module
+#include "../src/byte_stuffing.c"
+
+#define MAX_TAIL 64
+#define MAX_LENGTH (256 + MAX_TAIL)
+
+typedef struct
+{
+    const char *name;
+    StuffFn stuff;
+    RunFn run;
+    DestuffFn destuff;
+} Kernels;
+
+typedef enum
+{
+    PatternRandom,
+    PatternFlags,
+    PatternEscapes,
+    PatternFlowBytes,
+    PatternAlternating,
+    PatternCount
+} Pattern;
+
+static const char *pattern_names[PatternCount] = {
+    "random", "all 0x7E", "all 0x7D", "all XON/XOFF", "alternating 0x7E/0x7D"};
+
+static void fill_buffer(unsigned char *buf, int length, Pattern pattern)
+{
+    static const unsigned char specials[] = {FRAME_FLAG, ESCAPE_BYTE};
+    static const unsigned char flow[] = {XON_BYTE, XOFF_BYTE};
+    for (int i = 0; i < length; i++)
+    {
+        switch (pattern)
+        {
+        case PatternRandom:
+            // Mostly plain bytes, with specials often enough to split runs
+            buf[i] = rand() % 8 == 0 ? specials[rand() % 2] : rand();
+            break;
+        case PatternFlags:
+            buf[i] = FRAME_FLAG;
+            break;
+        case PatternEscapes:
+            buf[i] = ESCAPE_BYTE;
+            break;
+        case PatternFlowBytes:
+            buf[i] = flow[i % 2];
+            break;
+        default:
+            buf[i] = specials[i % 2];
+            break;
+        }
+    }
+}
+
+// Destuff src in two pieces split at split, so an escape can straddle them.
+// Returns the bytes consumed; *written and *in_escape as destuff_bytes().
+static int destuff_split(const Kernels *k, const unsigned char *src, int length, int split,
+                         unsigned char *dst, int dst_size, int *written, int *in_escape)
+{
+    int first_written, second_written = 0;
+    *in_escape = 0;
+    int used = k->destuff(src, split, dst, dst_size, &first_written, in_escape);
+    if (used == split)
+        used += k->destuff(src + split, length - split, dst + first_written,
+                           dst_size - first_written, &second_written, in_escape);
+    *written = first_written + second_written;
+    return used;
+}
+
+// Compare one kernel set against the scalar one on src. Returns 0 if they agree.
+static int compare_kernels(const Kernels *k, const Kernels *ref, const unsigned char *src,
+                           int length, int escape_flow)
+{
+    static unsigned char stuffed[2][2 * MAX_LENGTH + 1], plain[2][MAX_LENGTH];
+
+    int size = k->stuff(src, length, stuffed[0], escape_flow);
+    int ref_size = ref->stuff(src, length, stuffed[1], escape_flow);
+    if (size != ref_size || memcmp(stuffed[0], stuffed[1], size) != 0)
+        return -1;
+    if (k->run(src, length, escape_flow) != ref->run(src, length, escape_flow))
+        return -1;
+
+    // Split points through the vector-sized body and every one in the tail,
+    // then a closing flag, then a destination too short
+    stuffed[0][size] = FRAME_FLAG;
+    for (int split = 0; split <= size; split += split < size - 2 * MAX_TAIL ? 7 : 1)
+    {
+        int written, ref_written, in_escape, ref_in_escape;
+        int used = destuff_split(k, stuffed[0], size + 1, split, plain[0], length,
+                                 &written, &in_escape);
+        int ref_used = destuff_split(ref, stuffed[0], size + 1, split, plain[1], length,
+                                     &ref_written, &ref_in_escape);
+        if (used != ref_used || written != ref_written || in_escape != ref_in_escape)
+            return -1;
+        if (used != size || written != length || memcmp(plain[0], src, length) != 0)
+            return -1;
+    }
+
+    int short_size = length / 2;
+    int written, ref_written, in_escape = 0, ref_in_escape = 0;
+    int used = k->destuff(stuffed[0], size, plain[0], short_size, &written, &in_escape);
+    int ref_used = ref->destuff(stuffed[0], size, plain[1], short_size, &ref_written,
+                                &ref_in_escape);
+    if (used != ref_used || written != ref_written || in_escape != ref_in_escape ||
+        memcmp(plain[0], plain[1], written) != 0)
+        return -1;
+    return 0;
+}
+
+static int test_kernels(const Kernels *k, const Kernels *ref)
+{
+    static const int bodies[] = {0, 32, 256};
+    static unsigned char buf[MAX_LENGTH + 1];
+    int failures = 0;
+
+    for (int p = 0; p < PatternCount; p++)
+    {
+        for (int b = 0; b < (int)(sizeof(bodies) / sizeof(bodies[0])); b++)
+        {
+            for (int tail = 0; tail <= MAX_TAIL; tail++)
+            {
+                int length = bodies[b] + tail;
+                // Unaligned on purpose
+                unsigned char *src = buf + 1;
+                fill_buffer(src, length, (Pattern)p);
+                for (int escape_flow = 0; escape_flow <= 1; escape_flow++)
+                {
+                    if (compare_kernels(k, ref, src, length, escape_flow) == 0)
+                        continue;
+                    printf("%s: mismatch on %s, %d bytes, escape_flow %d\n", k->name,
+                           pattern_names[p], length, escape_flow);
+                    failures++;
+                }
+            }
+        }
+    }
+    printf("%s: %s\n", k->name, failures ? "FAIL" : "PASS");
+    return failures ? -1 : 0;
+}
+
+int main(void)
+{
+    srand(7);
+    Kernels scalar = {"scalar", stuff_scalar, run_scalar, destuff_scalar};
+    int failed = test_kernels(&scalar, &scalar) < 0;
+
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    Kernels sse2 = {"sse2", stuff_sse2, run_sse2, destuff_sse2};
+    Kernels avx2 = {"avx2", stuff_avx2, run_avx2, destuff_avx2};
+    if (__builtin_cpu_supports("sse2"))
+        failed += test_kernels(&sse2, &scalar) < 0;
+    else
+        printf("sse2: skipped, not supported by this CPU\n");
+    if (__builtin_cpu_supports("avx2"))
+        failed += test_kernels(&avx2, &scalar) < 0;
+    else
+        printf("avx2: skipped, not supported by this CPU\n");
+#endif
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+// Check that streaming LZ compression round-trips. A sender and a receiver
+// stream are fed the same sequence of chunks, as the application layer does:
+// a chunk that does not shrink is sent as is and passed to lz_append() on
+// the receiving end. Each stream runs well past the history size, so the
+// history is moved down several times, with matches reaching back close to
+// the full window, random chunks that cannot shrink and chunk sizes from a
+// single byte to LZ_MAX_CHUNK.
+//
+// Build: gcc -Wall -o bin/compression_test tests/compression_test.c src/compression.c
+// Run:   ./bin/compression_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/compression.h"
+
+#define STREAM_SIZE (1 << 20)
+
+typedef enum
+{
+    // Words from a small vocabulary: short matches nearby
+    SourceText,
+    // Random bytes: nothing to find, every chunk is sent as is
+    SourceRandom,
+    // Random blocks repeated just inside the window: long matches far back
+    SourceFarRepeats,
+    // Random chunks and text in turns, so matches cross uncompressed chunks
+    SourceMixed,
+    SourceCount
+} Source;
+
+static const char *source_names[SourceCount] = {"text", "random", "far repeats", "mixed"};
+
+static void fill_text(unsigned char *buf, int length)
+{
+    static const char *words[] = {"frame ", "window ", "serial ", "port ", "ack ", "retry ",
+                                  "timeout ", "flag ", "escape ", "packet ", "link ", "data "};
+    for (int i = 0; i < length;)
+    {
+        const char *word = words[rand() % 12];
+        for (int j = 0; word[j] != '\0' && i < length; j++)
+            buf[i++] = word[j];
+    }
+}
+
+static void fill_random(unsigned char *buf, int length)
+{
+    for (int i = 0; i < length; i++)
+        buf[i] = rand();
+}
+
+static void fill_stream(unsigned char *buf, Source source)
+{
+    switch (source)
+    {
+    case SourceText:
+        fill_text(buf, STREAM_SIZE);
+        break;
+    case SourceRandom:
+        fill_random(buf, STREAM_SIZE);
+        break;
+    case SourceFarRepeats:
+    {
+        // Each 4 KiB block is new or a copy of the one just under a window back
+        int block = 4096;
+        int back = LZ_WINDOW_SIZE - block;
+        for (int i = 0; i < STREAM_SIZE; i += block)
+        {
+            if (i >= back && rand() % 2)
+                memcpy(buf + i, buf + i - back, block);
+            else
+                fill_random(buf + i, block);
+        }
+        break;
+    }
+    default:
+        for (int i = 0; i < STREAM_SIZE; i += 8192)
+        {
+            if ((i / 8192) % 2)
+                fill_random(buf + i, 8192);
+            else
+                fill_text(buf + i, 8192);
+        }
+        break;
+    }
+}
+
+// Chunk sizes as packets would carry them, with the extremes now and then
+static int pick_chunk(int left)
+{
+    int length;
+    switch (rand() % 8)
+    {
+    case 0:
+        length = 1 + rand() % 8;
+        break;
+    case 1:
+        length = LZ_MAX_CHUNK;
+        break;
+    default:
+        length = 1 + rand() % 4000;
+        break;
+    }
+    return length < left ? length : left;
+}
+
+static int test_source(Source source)
+{
+    static unsigned char input[STREAM_SIZE];
+    static unsigned char packed[LZ_MAX_CHUNK], unpacked[LZ_MAX_CHUNK];
+
+    fill_stream(input, source);
+    LzStream *sender = lz_stream_new();
+    LzStream *receiver = lz_stream_new();
+    if (sender == NULL || receiver == NULL)
+    {
+        printf("%s: out of memory\n", source_names[source]);
+        return -1;
+    }
+
+    long sent = 0;
+    int chunks = 0, raw_chunks = 0, ok = 1;
+    for (int offset = 0; ok && offset < STREAM_SIZE; chunks++)
+    {
+        int length = pick_chunk(STREAM_SIZE - offset);
+        const unsigned char *chunk = input + offset;
+
+        // As the sender does: compressed only if that saves something
+        int size = lz_compress(sender, chunk, length, packed, length - 1);
+        int received;
+        if (size < 0)
+        {
+            lz_append(receiver, chunk, length);
+            memcpy(unpacked, chunk, length);
+            received = length;
+            sent += length;
+            raw_chunks++;
+        }
+        else
+        {
+            received = lz_decompress(receiver, packed, size, unpacked, sizeof(unpacked));
+            sent += size;
+        }
+
+        if (received != length || memcmp(unpacked, chunk, length) != 0)
+        {
+            printf("%s: chunk %d (%d bytes at %d) does not round-trip\n", source_names[source],
+                   chunks, length, offset);
+            ok = 0;
+        }
+        offset += length;
+    }
+
+    // Repeats must actually be found, and random data must not grow
+    if (ok && source == SourceText && sent > STREAM_SIZE * 3 / 5)
+    {
+        printf("%s: compressed to %ld bytes only\n", source_names[source], sent);
+        ok = 0;
+    }
+    if (ok && source == SourceFarRepeats && sent > STREAM_SIZE * 3 / 4)
+    {
+        printf("%s: matches across the window not found\n", source_names[source]);
+        ok = 0;
+    }
+    if (ok && sent > STREAM_SIZE)
+    {
+        printf("%s: grew to %ld bytes\n", source_names[source], sent);
+        ok = 0;
+    }
+
+    printf("%s: %s (%d chunks, %d sent as is, %ld -> %ld bytes)\n", source_names[source],
+           ok ? "PASS" : "FAIL", chunks, raw_chunks, (long)STREAM_SIZE, sent);
+    lz_stream_free(sender);
+    lz_stream_free(receiver);
+    return ok ? 0 : -1;
+}
+
+int main(void)
+{
+    srand(7);
+    int failed = 0;
+    for (int source = 0; source < SourceCount; source++)
+        failed += test_source((Source)source) < 0;
+    return failed ? 1 : 0;
+}
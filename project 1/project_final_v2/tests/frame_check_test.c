@@ -0,0 +1,137 @@
+// Check the frame check sequence kernels: CRC-16-CCITT (HDLC/X.25) and
+// CRC-32C against their published check values, slice-by-8 against a
+// bit-at-a-time reference, and the SSE4.2 CRC-32C against slice-by-8, at
+// every length up to MAX_LENGTH and every misalignment within a word. The
+// SSE4.2 comparison only runs where the CPU has it.
+//
+// Build: gcc -Wall -o bin/frame_check_test tests/frame_check_test.c
+// Run:   ./bin/frame_check_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The kernels are private to the module
+#include "../src/frame_check.c"
+
+#define MAX_LENGTH 300
+
+typedef struct
+{
+    const char *name;
+    const unsigned char *data;
+    int length;
+    uint32_t expected;
+} CheckValue;
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// One bit at a time, straight from the reflected polynomial
+static uint32_t crc_bitwise(uint32_t poly, uint32_t crc, const unsigned char *data, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+    }
+    return crc;
+}
+
+static void test_check_values(void)
+{
+    static const unsigned char digits[] = "123456789";
+    unsigned char zeros[32], ones[32], ascending[32];
+    memset(zeros, 0x00, sizeof(zeros));
+    memset(ones, 0xFF, sizeof(ones));
+    for (int i = 0; i < 32; i++)
+        ascending[i] = i;
+
+    // CRC-16/X.25 check value; 0x29B1 belongs to the unreflected
+    // CRC-16/CCITT-FALSE, which is not what HDLC sends
+    check(crc16_ccitt(digits, 9) == 0x906E, "CRC-16-CCITT of \"123456789\" is 0x906E");
+    check(crc16_ccitt(digits, 0) == 0x0000, "CRC-16-CCITT of nothing is 0x0000");
+
+    // The check value and the iSCSI vectors of RFC 3720, B.4
+    CheckValue crc32c_values[] = {
+        {"\"123456789\"", digits, 9, 0xE3069283},
+        {"32 bytes of 0x00", zeros, 32, 0x8A9136AA},
+        {"32 bytes of 0xFF", ones, 32, 0x62A8AB43},
+        {"32 ascending bytes", ascending, 32, 0x46DD794E},
+    };
+    for (int i = 0; i < (int)(sizeof(crc32c_values) / sizeof(crc32c_values[0])); i++)
+    {
+        char what[80];
+        snprintf(what, sizeof(what), "CRC-32C of %s is 0x%08X", crc32c_values[i].name,
+                 crc32c_values[i].expected);
+        check(crc32c(crc32c_values[i].data, crc32c_values[i].length) ==
+                  crc32c_values[i].expected, what);
+    }
+
+    // Least significant byte first, as HDLC sends it
+    unsigned char fcs[MAX_FCS_SIZE];
+    check(fcs_compute(LlFcsCrc16, digits, 9, fcs) == 2 && fcs[0] == 0x6E && fcs[1] == 0x90,
+          "CRC-16 frame check sequence is sent low byte first");
+    check(fcs_compute(LlFcsCrc32c, digits, 9, fcs) == 4 && fcs[0] == 0x83 && fcs[3] == 0xE3,
+          "CRC-32C frame check sequence is sent low byte first");
+    check(fcs_compute(LlFcsXor, digits, 9, fcs) == 1 && fcs[0] == 0x31,
+          "XOR frame check sequence of \"123456789\" is 0x31");
+}
+
+// Every length and every misalignment within a word
+static void test_kernels_agree(void)
+{
+    static unsigned char buf[MAX_LENGTH + 8];
+    for (int i = 0; i < (int)sizeof(buf); i++)
+        buf[i] = rand();
+
+    int sse42 = crc32c_has_sse42();
+    for (int offset = 0; offset < 8; offset++)
+    {
+        for (int length = 0; length <= MAX_LENGTH; length++)
+        {
+            const unsigned char *data = buf + offset;
+            char what[80];
+
+            uint32_t slice16 = crc_slice8(&crc16_tables, 0xFFFF, data, length);
+            snprintf(what, sizeof(what), "CRC-16 slice-by-8, %d bytes at offset %d", length, offset);
+            check(slice16 == crc_bitwise(CRC16_POLY_REFLECTED, 0xFFFF, data, length), what);
+
+            uint32_t slice32 = crc_slice8(&crc32c_tables, 0xFFFFFFFF, data, length);
+            snprintf(what, sizeof(what), "CRC-32C slice-by-8, %d bytes at offset %d", length, offset);
+            check(slice32 == crc_bitwise(CRC32C_POLY_REFLECTED, 0xFFFFFFFF, data, length), what);
+
+#ifdef HAVE_X86_CRC32
+            if (sse42)
+            {
+                snprintf(what, sizeof(what), "CRC-32C SSE4.2, %d bytes at offset %d", length, offset);
+                check(crc32c_sse42(0xFFFFFFFF, data, length) == slice32, what);
+            }
+#endif
+        }
+    }
+    if (!sse42)
+        printf("sse4.2: skipped, not supported by this CPU\n");
+}
+
+int main(void)
+{
+    srand(7);
+    pthread_once(&crc_once, init_crc);
+    printf("CRC-32C kernel: %s\n", crc32c_kernel());
+
+    test_check_values();
+    test_kernels_agree();
+
+    printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+// Check that llwrite() after llsubmit() filled the window waits for a slot
+// instead of overwriting an unacknowledged frame. Runs a transmitter and a
+// receiver over two pseudo-terminals joined by a relay thread, once per ARQ
+// mode, and expects every frame delivered in order and acknowledged.
+//
+// Build: gcc -Wall -o bin/link_window_test tests/link_window_test.c $(ls src/*.c | grep -v main.c) -lutil
+// Run:   ./bin/link_window_test
+
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../src/link_layer.h"
+
+#define PACKET_SIZE 200
+
+typedef struct
+{
+    int masters[2];
+    volatile int stop;
+} Relay;
+
+typedef struct
+{
+    LinkLayer params;
+    int expected;
+    int received;
+    int mismatches;
+} Receiver;
+
+// Copy bytes between the two pty masters, as the cable would
+static void *relay_bytes(void *arg)
+{
+    Relay *relay = arg;
+    struct pollfd pfds[2] = {
+        {.fd = relay->masters[0], .events = POLLIN},
+        {.fd = relay->masters[1], .events = POLLIN},
+    };
+    unsigned char buf[4096];
+
+    while (!relay->stop)
+    {
+        if (poll(pfds, 2, 50) <= 0)
+            continue;
+        for (int i = 0; i < 2; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+            ssize_t n = read(pfds[i].fd, buf, sizeof(buf));
+            if (n > 0 && write(relay->masters[1 - i], buf, n) != n)
+                perror("relay write");
+        }
+    }
+    return NULL;
+}
+
+static void fill_packet(unsigned char *packet, int index)
+{
+    for (int i = 0; i < PACKET_SIZE; i++)
+        packet[i] = (unsigned char)(index * 31 + i);
+}
+
+static void *receive_packets(void *arg)
+{
+    Receiver *rx = arg;
+    LinkSession *session = llsession_open(rx->params);
+    if (session == NULL)
+        return NULL;
+
+    unsigned char packet[MAX_PAYLOAD_LIMIT];
+    unsigned char expected[PACKET_SIZE];
+    while (rx->received < rx->expected)
+    {
+        int length = llsession_read(session, packet);
+        if (length <= 0)
+            break;
+        fill_packet(expected, rx->received);
+        if (length != PACKET_SIZE || memcmp(packet, expected, PACKET_SIZE) != 0)
+            rx->mismatches++;
+        rx->received++;
+    }
+    llsession_close(session, FALSE);
+    return NULL;
+}
+
+// Open a pty in raw mode and return its master; the slave's path goes in name
+static int open_pty(char *name, int *slave)
+{
+    int master;
+    if (openpty(&master, slave, name, NULL, NULL) < 0)
+    {
+        perror("openpty");
+        return -1;
+    }
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    return master;
+}
+
+static int run_case(LinkArqMode mode, int window, const char *label)
+{
+    char names[2][64];
+    int slaves[2];
+    Relay relay = {.stop = 0};
+    for (int i = 0; i < 2; i++)
+    {
+        relay.masters[i] = open_pty(names[i], &slaves[i]);
+        if (relay.masters[i] < 0)
+            return -1;
+    }
+
+    LinkLayer params;
+    memset(&params, 0, sizeof(params));
+    params.baudRate = 115200;
+    params.nRetransmissions = 3;
+    params.timeout = 1;
+    params.options.arqMode = mode;
+    params.options.windowSize = window;
+
+    // llsubmit() fills the window, llwrite() adds one more frame
+    int expected = (mode == LlStopAndWait ? 1 : window) + 1;
+
+    Receiver rx = {.params = params, .expected = expected};
+    rx.params.role = LlRx;
+    strcpy(rx.params.serialPort, names[1]);
+
+    pthread_t relay_thread, rx_thread;
+    pthread_create(&relay_thread, NULL, relay_bytes, &relay);
+    pthread_create(&rx_thread, NULL, receive_packets, &rx);
+
+    params.role = LlTx;
+    strcpy(params.serialPort, names[0]);
+    LinkSession *session = llsession_open(params);
+
+    int submitted = 0;
+    long acknowledged = 0;
+    int ok = session != NULL;
+    unsigned char packet[PACKET_SIZE];
+    while (ok && submitted < expected - 1)
+    {
+        fill_packet(packet, submitted);
+        int result = llsession_submit(session, packet, PACKET_SIZE);
+        ok = result == PACKET_SIZE;
+        submitted += ok;
+    }
+
+    if (ok)
+    {
+        fill_packet(packet, submitted);
+        ok = llsession_write(session, packet, PACKET_SIZE) == PACKET_SIZE;
+    }
+
+    // Every frame must be acknowledged, the last data one included
+    for (int i = 0; ok && acknowledged < expected && i < 100; i++)
+    {
+        LinkEvents events;
+        if (llsession_poll(session, 50, &events) < 0)
+            ok = 0;
+        else
+            acknowledged += events.acknowledged;
+    }
+    if (session != NULL)
+        llsession_close(session, FALSE);
+
+    pthread_join(rx_thread, NULL);
+    relay.stop = 1;
+    pthread_join(relay_thread, NULL);
+    for (int i = 0; i < 2; i++)
+    {
+        close(relay.masters[i]);
+        close(slaves[i]);
+    }
+
+    ok = ok && acknowledged == expected && rx.received == expected && rx.mismatches == 0;
+    printf("%s: %s (%ld/%d acknowledged, %d/%d received, %d corrupt)\n", label,
+           ok ? "PASS" : "FAIL", acknowledged, expected, rx.received, expected, rx.mismatches);
+    return ok ? 0 : -1;
+}
+
+int main(void)
+{
+    int failed = 0;
+    failed += run_case(LlStopAndWait, 1, "stop-and-wait") < 0;
+    failed += run_case(LlGoBackN, MAX_WINDOW_SIZE, "go-back-n") < 0;
+    failed += run_case(LlSelectiveRepeat, MAX_WINDOW_SIZE, "selective repeat") < 0;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,125 @@
+// Check Reed-Solomon encoding and decoding. For every parity size, random
+// buffers (single short blocks, full blocks and several blocks) get up to
+// parity / 2 corrupted bytes per block, in the data and in the parity, and
+// must be repaired exactly. One byte more must make rs_decode() fail.
+//
+// Beyond parity / 2 errors a word can land within parity / 2 of another
+// codeword, and then any decoder repairs it to that one; for the smaller
+// codes that is common (BCC2 catches it in the link). The failure is only
+// required from RS_STRICT_PARITY up, where it is vanishingly rare.
+//
+// Build: gcc -Wall -o bin/reed_solomon_test tests/reed_solomon_test.c src/reed_solomon.c
+// Run:   ./bin/reed_solomon_test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/reed_solomon.h"
+
+#define TRIALS 300
+#define MAX_LENGTH 1000
+#define RS_STRICT_PARITY 16
+
+// Corrupt "errors" distinct bytes of each block, or fewer if it is shorter.
+// Returns the number of bytes corrupted.
+static int corrupt_blocks(unsigned char *encoded, int size, int errors)
+{
+    int total = 0;
+    for (int idx = 0; idx < size; idx += RS_BLOCK_SIZE)
+    {
+        int block = size - idx < RS_BLOCK_SIZE ? size - idx : RS_BLOCK_SIZE;
+        int count = errors < block ? errors : block;
+        unsigned char hit[RS_BLOCK_SIZE] = {0};
+        for (int i = 0; i < count; i++)
+        {
+            int pos;
+            do
+                pos = rand() % block;
+            while (hit[pos]);
+            hit[pos] = 1;
+            encoded[idx + pos] ^= 1 + rand() % 255;
+        }
+        total += count;
+    }
+    return total;
+}
+
+// Random length: a short block, exactly one full block, or several
+static int pick_length(int parity, int trial)
+{
+    int block_data = RS_BLOCK_SIZE - parity;
+    switch (trial % 3)
+    {
+    case 0:
+        return 1 + rand() % block_data;
+    case 1:
+        return block_data;
+    default:
+        return block_data + 1 + rand() % (MAX_LENGTH - block_data);
+    }
+}
+
+static int test_parity(int parity)
+{
+    static unsigned char data[MAX_LENGTH];
+    static unsigned char encoded[2 * MAX_LENGTH];
+    int repair_failures = 0, missed = 0, miscorrected = 0;
+
+    for (int trial = 0; trial < TRIALS; trial++)
+    {
+        int length = pick_length(parity, trial);
+        for (int i = 0; i < length; i++)
+            data[i] = rand();
+
+        int size = rs_encode(data, length, parity, encoded);
+        if (size != rs_encoded_size(length, parity))
+        {
+            printf("parity %d: bad encoding of %d bytes\n", parity, length);
+            return -1;
+        }
+
+        // Anything up to the limit, the limit itself every other time
+        int errors = trial % 2 ? parity / 2 : rand() % (parity / 2 + 1);
+        int expected = corrupt_blocks(encoded, size, errors);
+        int corrected;
+        if (rs_decode(encoded, size, parity, &corrected) != length ||
+            memcmp(encoded, data, length) != 0 || corrected != expected)
+        {
+            printf("parity %d: %d bytes with %d errors not repaired\n", parity, length, expected);
+            repair_failures++;
+        }
+
+        // One error past the limit in a single block
+        length = 1 + rand() % (RS_BLOCK_SIZE - parity);
+        for (int i = 0; i < length; i++)
+            data[i] = rand();
+        size = rs_encode(data, length, parity, encoded);
+        if (parity / 2 + 1 > size)
+            continue;
+        corrupt_blocks(encoded, size, parity / 2 + 1);
+        if (rs_decode(encoded, size, parity, &corrected) >= 0)
+        {
+            // The original cannot be reached with parity / 2 repairs
+            if (memcmp(encoded, data, length) == 0)
+                missed++;
+            else
+                miscorrected++;
+        }
+    }
+
+    int ok = repair_failures == 0 && missed == 0 &&
+             (parity < RS_STRICT_PARITY || miscorrected == 0);
+    printf("parity %2d: %s (%d/%d past the limit repaired to another codeword)\n", parity,
+           ok ? "PASS" : "FAIL", miscorrected, TRIALS);
+    return ok ? 0 : -1;
+}
+
+int main(void)
+{
+    srand(7);
+    int failed = 0;
+    for (int parity = 2; parity <= RS_MAX_PARITY; parity += 2)
+        failed += test_parity(parity) < 0;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+// Convert a link trace dumped with --trace to Chrome trace JSON, to open in
+// chrome://tracing or https://ui.perfetto.dev.
+//
+// Build: gcc -Wall -o bin/trace2chrome tools/trace2chrome.c src/trace.c
+
+#include <stdio.h>
+
+#include "../src/trace.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        printf("Usage: %s trace.bin trace.json\n", argv[0]);
+        return 1;
+    }
+
+    if (trace_convert_chrome(argv[1], argv[2]) < 0)
+    {
+        return 2;
+    }
+
+    printf("Wrote %s\n", argv[2]);
+    return 0;
+}